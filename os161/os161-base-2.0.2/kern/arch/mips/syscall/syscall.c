@@ -35,6 +35,7 @@
 #include <current.h>
 #include <addrspace.h>
 #include <syscall.h>
+#include <copyinout.h>
 
 
 /*
@@ -163,6 +164,62 @@ syscall(struct trapframe *tf)
 	        err = sys_fork(tf,&retval);
                 break;
 #endif
+#if OPT_PAGING
+	    case SYS_spawn:
+	        err = sys_spawn((userptr_t)tf->tf_a0,
+				(userptr_t)tf->tf_a1, &retval);
+                break;
+	    case SYS_execv:
+	        err = sys_execv((userptr_t)tf->tf_a0,
+				(userptr_t)tf->tf_a1);
+                break;
+	    case SYS_sbrk:
+	        err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+                break;
+	    case SYS_madvise:
+	        err = sys_madvise((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				  (int)tf->tf_a2);
+                break;
+	    case SYS_mlock:
+	        err = sys_mlock((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+                break;
+	    case SYS_munlock:
+	        err = sys_munlock((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+                break;
+	    case SYS_getvmusage:
+	        err = sys_getvmusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+                break;
+#if OPT_SHM
+	    case SYS_shmget:
+	        err = sys_shmget((int)tf->tf_a0, (size_t)tf->tf_a1, &retval);
+                break;
+	    case SYS_shmat:
+	        err = sys_shmat((int)tf->tf_a0, (vaddr_t *)&retval);
+                break;
+	    case SYS_shmdt:
+	        err = sys_shmdt((vaddr_t)tf->tf_a0);
+                break;
+	    case SYS_shmrm:
+	        err = sys_shmrm((int)tf->tf_a0);
+                break;
+#endif
+#if OPT_FILE
+	    case SYS_mmap:
+	    {
+		/* the fifth argument, the offset, is on the user stack */
+		int32_t offset;
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &offset, sizeof(offset));
+		if (err == 0)
+			err = sys_mmap((size_t)tf->tf_a0, (int)tf->tf_a1,
+				       (int)tf->tf_a2, (int)tf->tf_a3,
+				       offset, (vaddr_t *)&retval);
+	    }
+                break;
+	    case SYS_munmap:
+	        err = sys_munmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+                break;
+#endif
+#endif
 
 #endif
 
@@ -172,6 +229,11 @@ syscall(struct trapframe *tf)
 		break;
 	}
 
+#if OPT_PAGING
+	/* the OOM killer may have chosen this process meanwhile */
+	as_oom_exit();
+#endif
+
 
 	if (err) {
 		/*
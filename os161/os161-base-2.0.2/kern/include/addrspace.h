@@ -42,9 +42,12 @@
 #if OPT_PAGING
 
 #define ALLIGN_NEXT_ADDR(paddr) (paddr % PAGE_SIZE == 0 ? paddr : ((paddr/PAGE_SIZE + 1) * PAGE_SIZE))
+//entries that fit in the frames allocated for a page table of n entries
+#define PT_CAPACITY(n) (DIVROUNDUP((n) * sizeof(pt_entry), PAGE_SIZE) * PAGE_SIZE / sizeof(pt_entry))
 
 #include "pt.h"
 #include "segment.h"
+#include "vmstats.h"
 
 #endif
 
@@ -66,11 +69,22 @@ struct addrspace {
         paddr_t as_stackpbase;
 #else
         pt_entry* as_pt; //array of the page table entries
-	segment_t* as_segment; //linked list of the segments in the address space
+	segment_t* as_segment; //linked list of the segments in the address space, sorted by as_prepare_load
+	segment_t **as_segidx; //the same segments as an array, for the binary search in vm_fault
+	unsigned nsegs;
 	struct vnode *v; //points to the ELF, used to do on-demand page loading
 	unsigned npages; //total number of pages in the page table
+        unsigned ptcap; //entries that fit in the frames of as_pt
         struct lock *pt_lock;
         char* progname; //used to save the ELF name to be passed during as_copy
+        unsigned reserved; //writable pages accounted with swap_reserve
+        bool oom_killed; //chosen by the OOM killer, exits at the next fault or syscall
+        struct vmprofile *profile; //startup faults being recorded, see vmprofile.h
+        segment_t *heap; //right after the highest ELF segment, grows towards the stack
+        segment_t *stack; //ends at USERSTACK, grows down on faults
+        vaddr_t brk; //current break, the heap segment ends at the page holding it
+        unsigned nlocked; //pages locked with mlock, at most mlock_maxpages
+        struct vm_rusage ru; //paging of this process, updated under pt_lock or by its own faults
 #endif
 };
 
@@ -117,6 +131,28 @@ struct addrspace {
 
 #if OPT_PAGING
 int checkcanLock(void);
+void as_oom_exit(void);
+void as_reset(struct addrspace *as, struct vnode *v, char *progname);
+int as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk);
+extern unsigned stack_maxpages;
+int as_set_stackmax(unsigned npages);
+int as_mmap(struct addrspace *as, struct vnode *vn, size_t len, off_t offset, unsigned rwx, vaddr_t *addr);
+int as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int as_mmap_writeback(struct addrspace *as, pt_entry *pte);
+int as_mmap_fill(segment_t *seg, paddr_t paddr, vaddr_t vaddr);
+int as_madvise(struct addrspace *as, vaddr_t addr, size_t len, int advice);
+extern unsigned mlock_maxpages;
+int as_set_mlockmax(unsigned npages);
+int as_mlock(struct addrspace *as, vaddr_t addr, size_t len);
+int as_munlock(struct addrspace *as, vaddr_t addr, size_t len);
+pt_entry *as_lookup_pte(struct addrspace *as, vaddr_t va);
+void as_rss_add(struct addrspace *as, int npages);
+void as_getrusage(struct addrspace *as, struct vm_rusage *ru);
+void as_print_rusage(struct addrspace *as, const char *name);
+int as_shmat(struct addrspace *as, int id, vaddr_t *addr);
+int as_shmdt(struct addrspace *as, vaddr_t addr);
+bool as_shm_mapping(struct addrspace *as, vaddr_t vaddr, unsigned *refs);
+void as_shm_drop(struct addrspace *as, vaddr_t vaddr);
 struct addrspace *as_create(char *prog_name,int *retVal);
 int as_copy(struct addrspace *old, struct addrspace **ret);
 #else
@@ -147,7 +183,12 @@ int load_segment(struct addrspace *as, struct vnode *v,
 			 int is_executable);
 
 #if OPT_PAGING
+#define ELF_MAXREADAHEAD 8 //upper bound of the read-ahead window, in pages
+extern unsigned elf_readahead;
 int load_elf_ondemand(segment_t* seg, paddr_t paddr, vaddr_t vaddr);
+int elf_set_readahead(unsigned npages);
+unsigned elf_cluster_pages(segment_t *seg, vaddr_t vaddr, unsigned max);
+int load_elf_cluster(segment_t *seg, paddr_t *paddrs, vaddr_t vaddr, unsigned npages);
 #endif
 
 #endif /* _ADDRSPACE_H_ */
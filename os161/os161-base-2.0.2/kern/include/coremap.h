@@ -5,13 +5,16 @@
 // #define CGETVPN(i) ((uint32_t)(coremap[(i)].vaddr >> 12))       //get virtual page NUMBER (not address)
 // #define CGETVA(i) ((uint32_t)CGETVPN((i))*4096)          //returns virtual address of frame at index a
 // #define CENTRY_GET_PID(a) ((uint32_t)((a)&0xfff) >> 2) //returns owner process' id
-#define CRES(i) ((int)(coremap[(i)].vaddr & 0x3) && (0x1))                     //tells if the frame is reserved or not
+#define CRES(i) ((int)(coremap[(i)].vaddr & 0x1))                     //tells if the frame is reserved (or pinned) or not
 #define CUSED(i) ((int)(coremap[(i)].vaddr & 0x2) && (0x2))            //tells if the frame is valid or not
+#define CMERGED(i) ((int)(coremap[(i)].vaddr & 0x4))                   //tells if the frame was merged by ksm
+#define CCOW(i) ((int)(coremap[(i)].vaddr & 0x8))                      //tells if the frame is shared copy-on-write, by a fork or by ksm
 
 typedef struct c_entry {
     vaddr_t vaddr; 
     struct addrspace *as; //useful when doing as_destroy
     uint32_t allocpages; //useful when allocating multiple pages at once
+    uint32_t refcount; //address spaces sharing the frame copy-on-write, 0 if it has one owner
 }c_entry;
 c_entry *coremap;
 
@@ -19,6 +22,19 @@ void coremap_init(void);
 int isCoremapActive(void);
 paddr_t getPages(int npages, vaddr_t vaddr, struct addrspace* as);
 void freeAs(struct addrspace *as);
+void reclaimWait(void);
 void freepages(paddr_t paddr);
+void setPageOwner(paddr_t paddr, struct addrspace *as);
+void sharePage(paddr_t paddr, bool cow);
+bool claimSharedPage(paddr_t paddr, struct addrspace *as);
+void putSharedPage(paddr_t paddr);
+unsigned getPageRefs(paddr_t paddr);
+bool mergePage(paddr_t paddr, struct addrspace *as);
+bool refMergedPage(paddr_t paddr);
+void countMergedPages(unsigned *shared, unsigned *sharing);
+void pinPage(paddr_t paddr, struct addrspace *as);
+void unpinPage(paddr_t paddr, struct addrspace *as);
+unsigned getRamPages(void);
+paddr_t reservePages(unsigned npages);
 paddr_t ptAlloc(unsigned npages);
 #endif
\ No newline at end of file
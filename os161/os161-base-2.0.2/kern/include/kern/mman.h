@@ -0,0 +1,25 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap and madvise, shared between the kernel and
+ * userland.
+ */
+
+/* mmap prot */
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+/* mmap flags */
+#define MAP_SHARED      0x1
+#define MAP_PRIVATE     0x2
+
+/* madvise advice */
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,27 @@
+#ifndef _KERN_VMUSAGE_H_
+#define _KERN_VMUSAGE_H_
+
+/*
+ * Argument and result of getvmusage, shared between the kernel and
+ * userland.
+ */
+
+#define RUSAGE_SELF 0
+
+/*
+ * Paging done by a single address space, returned by getvmusage.
+ * Counts are in pages.
+ */
+struct vm_rusage {
+    unsigned ru_rss;       //pages with a frame, the zero frame and swap excluded
+    unsigned ru_maxrss;    //highest ru_rss so far
+    unsigned ru_swapped;   //pages in swap
+    unsigned ru_tlbfaults;
+    unsigned ru_reloads;   //faults on resident pages
+    unsigned ru_zerofills;
+    unsigned ru_elfreads;
+    unsigned ru_swapins;
+    unsigned ru_swapouts;
+};
+
+#endif /* _KERN_VMUSAGE_H_ */
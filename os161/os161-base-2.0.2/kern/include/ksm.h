@@ -0,0 +1,32 @@
+#ifndef _KSM_H_
+#define _KSM_H_
+
+#include <types.h>
+#include <mips/types.h>
+#include <addrspace.h>
+
+#define KSM_MAXSPACES 32  //address spaces scanned, the ones created later are skipped
+#define KSM_MAXSTABLE 256 //merged frames remembered
+#define KSM_MAXUNSTABLE 256 //candidates remembered during a round
+
+/*
+ * Same-page merging: a kernel thread, started the first time it is enabled,
+ * wakes every ksm_sleep_secs seconds and hashes ksm_pages_to_scan resident
+ * pages of the writable private segments. A page identical to a merged frame
+ * (stable table) maps it copy-on-write and its own frame is freed; a page
+ * identical to another candidate of the same round (unstable table) turns
+ * the other frame into a merged one first. Merged frames are shared like
+ * the ones of a fork: split again by the first write to them, and swapped
+ * out by evictShared when RAM is full.
+ *
+ * Lock order: ksm_lock before pt_lock, as_destroy calls ksm_forget first.
+ */
+extern unsigned ksm_pages_to_scan;
+extern unsigned ksm_sleep_secs;
+
+void ksm_init(void);
+void ksm_register(struct addrspace *as);
+void ksm_forget(struct addrspace *as);
+int ksm_set(bool run, unsigned pages, unsigned secs);
+void ksm_print(void);
+#endif
@@ -0,0 +1,29 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+#include <types.h>
+#include <mips/types.h>
+#include <addrspace.h>
+
+/*
+ * Page cache for the read-only pages of the executables: processes running
+ * the same binary map the same frame instead of each reading a private copy.
+ * Pages are keyed by (vnode, file offset, virtual address) and counted by the
+ * page table entries mapping them. Unreferenced pages stay cached, so a new
+ * run of the binary finds them warm, until their frame is needed again.
+ *
+ * The pages of shared file mappings are cached too, keyed by (vnode, file
+ * offset) only, so that all the processes mapping a file share its pages
+ * whatever address they map them at. They stay cached only while mapped,
+ * and are taken back by the coremap through pagecache_file_victim and
+ * pagecache_take.
+ */
+void pagecache_init(void);
+int pagecache_get(struct addrspace *as, segment_t *seg, vaddr_t vaddr, unsigned ra, paddr_t *paddr);
+int pagecache_get_file(struct addrspace *as, segment_t *seg, vaddr_t vaddr, paddr_t *paddr);
+paddr_t pagecache_file_victim(void);
+bool pagecache_take(paddr_t paddr);
+void pagecache_ref(paddr_t paddr);
+void pagecache_put(paddr_t paddr);
+paddr_t pagecache_reclaim(void);
+#endif
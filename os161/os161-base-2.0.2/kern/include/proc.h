@@ -127,6 +127,10 @@ int proc_wait(struct proc *proc);
 struct proc *proc_search_pid(pid_t pid);
 /* signal end/exit of process */
 void proc_signal_end(struct proc *proc);
+/* marks the biggest process not yet killed for the OOM killer, returns its address space */
+struct addrspace *proc_oom_victim(void);
+/* address spaces of all the processes, one per call */
+struct addrspace *proc_next_as(int *pid);
 #if OPT_FILE
 void proc_file_table_copy(struct proc *psrc, struct proc *pdest);
 #endif
@@ -4,11 +4,26 @@
 #include <types.h>
 #include <mips/types.h>
 
+/* access hints given with madvise */
+#define PT_ADV_NORMAL 0
+#define PT_ADV_SEQUENTIAL 1 //widest read-ahead, evicted first once the scan is past it
+#define PT_ADV_RANDOM 2     //no read-ahead
+
 typedef struct pt_entry {
     paddr_t paddr;
 	vaddr_t vaddr;
 	bool in_mem : 1;
 	bool in_swap : 1;
+	bool zero_fill : 1; //evicted while all zero, no swap slot: zero-filled again on the next fault
+	bool shared : 1; //maps a frame of the page cache, released with pagecache_put
+	bool cow : 1; //frame shared with a forked address space, copied on the first write
+	bool readahead : 1; //loaded by ELF read-ahead and not accessed yet
+	bool mapped : 1; //belongs to a file mapping, evicted to the file instead of swap
+	bool dirty : 1; //mapped page written since it was read, mapped read-only until then
+	bool shm : 1; //shared memory page, the frame is referenced like a copy-on-write one
+	unsigned advice : 2; //one of the PT_ADV_ hints
+	bool locked : 1; //mlock-ed, its frame is pinned in the coremap
+	bool zero : 1; //maps the shared zero frame read-only, the first write gets a frame of its own
 	unsigned rwx : 3; //read, write, execute flags
 }pt_entry;
 
@@ -3,6 +3,15 @@
 
 #include <mips/types.h>
 
+struct vnode;
+struct shm_object;
+
+#define SEG_ELF 0   //loaded on demand from the ELF file
+#define SEG_STACK 1 //zero-filled on demand
+#define SEG_HEAP 2  //zero-filled on demand, resized by sbrk
+#define SEG_MMAP 3  //file mapping, offset is the position in vn of its first page
+#define SEG_SHM 4   //attached shared memory object
+
 typedef struct segment_t
 {
         vaddr_t start;
@@ -10,9 +19,13 @@ typedef struct segment_t
         size_t filesize;
         size_t npages;
         unsigned rwx : 3; //read-write-execute flags -> used to set them in the page table entries
+        unsigned type : 3; //one of the SEG_ values above
         off_t offset; //offset in the ELF file
         size_t initoffset;      //this and all of the above are used to read from the
                                 //ELF file when doing on-demand page loading
+        unsigned ptbase;        //page table index of the first page of the segment
+        struct vnode *vn;       //mapped file of a SEG_MMAP segment, referenced
+        struct shm_object *shm; //object of a SEG_SHM segment, attached
         struct segment_t *next; //points to the next segment in the list
 } segment_t;
 
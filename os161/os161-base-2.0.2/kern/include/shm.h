@@ -0,0 +1,31 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <types.h>
+#include <mips/types.h>
+#include <addrspace.h>
+
+#define SHM_MAXOBJECTS 16
+#define SHM_MAXPAGES 256  //size limit of an object
+#define SHM_MAXATTACH 8   //address spaces attached to an object at the same time
+#define SHM_PRIVATE 0     //key of a new object no shm_get can find
+
+/*
+ * System V style shared memory: objects of anonymous pages, created (or
+ * looked up) by key and attached to any number of address spaces, where
+ * they become a SEG_SHM segment. The object owns its pages: a resident page
+ * is a frame with a reference for the object and one for each page table
+ * entry mapping it, as for copy-on-write frames. A page nobody maps can be
+ * written to swap by shm_reclaim and is read back at the next fault.
+ * An object removed with shm_remove goes away with its last attachment.
+ */
+void shm_init(void);
+int shm_get(int key, size_t size, int *id);
+int shm_remove(int id);
+int shm_size(int id, unsigned *npages);
+int shm_attach(int id, unsigned npages, struct addrspace *as, vaddr_t vaddr, struct shm_object **obj);
+int shm_attach_object(struct shm_object *obj, struct addrspace *as, vaddr_t vaddr);
+void shm_detach(struct shm_object *obj, struct addrspace *as);
+int shm_getpage(struct shm_object *obj, unsigned k, vaddr_t vaddr, struct addrspace *as, paddr_t *paddr);
+paddr_t shm_reclaim(void);
+#endif
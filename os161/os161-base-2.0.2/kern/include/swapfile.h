@@ -4,14 +4,30 @@
 #include <vnode.h>
 #include <addrspace.h>
 #include <mips/types.h>
+#include <uio.h>
 
 
 #define SWAP_VALID   0x00000200
+#define SWAP_MAXCLUSTER 8 //max pages moved by a single swap device request
+
+/* overcommit policies, see swap_reserve */
+#define VM_OVERCOMMIT_GUESS  0
+#define VM_OVERCOMMIT_ALWAYS 1
+#define VM_OVERCOMMIT_NEVER  2
 void swapmap_init(void);
 void close_swapfile(void);
+int swapon(const char *devname, int prio);
+void swap_print_devs(void);
 
 int swap_in(paddr_t *swap_paddr, paddr_t ram_paddr, bool toRemove);
 int swap_out(paddr_t *paddr);
+int swap_io(unsigned slot, vaddr_t kvaddr, enum uio_rw rw);
+int swap_io_cluster(unsigned slot, vaddr_t *kvaddrs, unsigned npages, enum uio_rw rw);
+bool swap_adjacent(unsigned slot, unsigned next);
 void clear_swap(paddr_t paddr);
+void swap_dup(unsigned slot);
 unsigned getAvailableSwap(void);
+int swap_reserve(unsigned npages);
+void swap_unreserve(unsigned npages);
+int swap_set_overcommit(int policy);
 #endif
\ No newline at end of file
@@ -35,6 +35,12 @@
 #include "opt-syscalls.h"
 #include "opt-fork.h"
 #include "opt-file.h"
+#include "opt-paging.h"
+#include "opt-shm.h"
+
+#define SPAWN_MAXARGS 16 //arguments of sys_spawn, program path included
+#define SPAWN_ARGMAX 1024 //total bytes of the arguments of sys_spawn
+#define EXECV_ARGMAX 4096 //path, argv pointers and strings of sys_execv
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -68,6 +74,10 @@ struct openfile;
 void openfileIncrRefCount(struct openfile *of);
 int sys_open(userptr_t path, int openflags, mode_t mode, int *errp);
 int sys_close(int fd);
+#if OPT_PAGING
+int sys_mmap(size_t len, int prot, int flags, int fd, off_t offset, vaddr_t *retval);
+int sys_munmap(vaddr_t addr, size_t len);
+#endif
 #endif
 int sys_write(int fd, userptr_t buf_ptr, size_t size);
 int sys_read(int fd, userptr_t buf_ptr, size_t size);
@@ -77,6 +87,21 @@ pid_t sys_getpid(void);
 #if OPT_FORK
 int sys_fork(struct trapframe *ctf, pid_t *retval);
 #endif
+#if OPT_PAGING
+int sys_spawn(userptr_t path, userptr_t argv, pid_t *retval);
+int sys_execv(userptr_t path, userptr_t argv);
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_madvise(vaddr_t addr, size_t len, int advice);
+int sys_mlock(vaddr_t addr, size_t len);
+int sys_munlock(vaddr_t addr, size_t len);
+int sys_getvmusage(int who, userptr_t ru);
+#if OPT_SHM
+int sys_shmget(int key, size_t size, int *retval);
+int sys_shmat(int id, vaddr_t *retval);
+int sys_shmdt(vaddr_t addr);
+int sys_shmrm(int id);
+#endif
+#endif
 
 #endif
 
@@ -100,6 +100,7 @@ int nettest(int, char **);
 int runprogram(char *progname);
 #if OPT_ARGS
 int runprogramWithArgs(char **args, unsigned long nargs);
+int loadprogramWithArgs(char **args, unsigned long nargs, vaddr_t *entrypoint, vaddr_t *stackptr);
 #endif
 /* Kernel menu system. */
 void menu(char *argstr);
@@ -6,4 +6,8 @@ int tlb_loadentry(vaddr_t faultaddress, paddr_t paddr, bool readOnly);
 int tlb_get_rr_victim(void);
 void tlb_invalidate(void);
 void tlb_invalidate_vaddr(vaddr_t vaddr);
+
+struct addrspace;
+void tlb_shootdown_init(void);
+void tlb_shootdown(struct addrspace *as, vaddr_t vaddr);
 #endif
\ No newline at end of file
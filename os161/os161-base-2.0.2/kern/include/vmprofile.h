@@ -0,0 +1,31 @@
+#ifndef _VMPROFILE_H_
+#define _VMPROFILE_H_
+
+#include <types.h>
+#include <mips/types.h>
+#include <addrspace.h>
+
+/*
+ * Startup profiles: the first run of a program records the pages of its
+ * first VMPROFILE_PAGES faults served from the ELF or zero-filled, and saves
+ * them next to the binary as "<progname>.pf", a path made absolute when the
+ * program starts. Later runs fault those pages in before entering user
+ * mode, sorted so that read-ahead clusters them.
+ * A profile recorded for a binary of a different size is ignored and
+ * recorded again.
+ */
+#define VMPROFILE_PAGES 64
+#define VMPROFILE_MAGIC 0x766d7066
+
+struct vmprofile {
+    uint32_t magic;
+    uint32_t binsize;  //size of the binary the profile was recorded on
+    uint32_t npages;
+    vaddr_t pages[VMPROFILE_PAGES];
+    char *path;        //absolute, resolved at start; not saved
+};
+
+void vmprofile_start(struct addrspace *as);
+void vmprofile_record(struct addrspace *as, vaddr_t vaddr);
+void vmprofile_save(struct addrspace *as);
+#endif
@@ -1,6 +1,8 @@
 #ifndef VM_STATS_H
 #define VM_STATS_H
 
+#include <kern/vmusage.h>
+
 enum {
     TLB_FAULT, 
     TLB_FAULT_WITH_FREE, 
@@ -12,14 +14,54 @@ enum {
     ELF_READ, 
     SWAP_READ, 
     SWAP_WRITE, 
+    SWAP_POOL_STORE,
+    SWAP_POOL_SAMEFILL,
+    SWAP_POOL_BYTES,
+    SWAP_POOL_HIT,
+    SWAP_POOL_WRITEBACK,
+    SWAP_POOL_REJECT,
+    SWAP_ZERO_SKIP,
+    OOM_RECLAIM,
+    PAGE_CACHE_HIT,
+    COW_FAULT,
+    ELF_READAHEAD,
+    ELF_READAHEAD_HIT,
+    STACK_GROWTH,
+    MMAP_WRITEBACK,
+    DROP_BEHIND,
+    PAGES_LOCKED,
+    PAGES_UNLOCKED,
+    KSM_MERGE,
+    ZERO_PAGE_MAP,
+    COW_EVICT,
 };
 
-#define STATS_TOT 10
+#define STATS_TOT 30
 
 void vm_stats_init(void);                    
 
 void vm_stats_inc(unsigned int index);   
 
+void vm_stats_add(unsigned int index, unsigned int amount);
+
 void vm_stats_print(void);                    
 
+/* latencies kept in log2 histograms, in nanoseconds */
+enum {
+    LAT_FAULT,    //vm_fault, reloads excluded
+    LAT_RELOAD,   //vm_fault on a resident page
+    LAT_SWAP_IN,
+    LAT_SWAP_OUT, //pages kept by the compressed pool included
+    LAT_ELF_LOAD, //a page, or a read-ahead cluster, read from the ELF
+};
+
+#define LAT_TOT 5
+#define LAT_BUCKETS 32 //bucket k holds [2^k, 2^(k+1)) ns, the last one everything above
+
+uint64_t vm_lat_now(void);
+
+uint64_t vm_lat_record(unsigned int type, uint64_t start);
+
+void vm_lat_print(void);
+
 #endif /* VM_STATS_H */
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef _VMTRACE_H_
+#define _VMTRACE_H_
+
+#include <types.h>
+#include <mips/types.h>
+#include "opt-vmtrace.h"
+
+/*
+ * VM event trace: each CPU appends to a ring of its own with interrupts
+ * off, so recording takes no lock; the oldest events are overwritten.
+ * The rings are allocated the first time tracing is enabled, and a
+ * disabled trace costs a test of vmtrace_on at each event.
+ * CPUs numbered VMTRACE_MAXCPUS or more are not traced.
+ */
+#define VMTRACE_MAXCPUS 8
+#define VMTRACE_RINGSIZE 512 //events per CPU, a power of two
+#define VMTRACE_MAGIC 0x766d7472
+
+/* event types, with the meaning of their two arguments */
+#define VMTR_FAULT 1  //faulting vaddr; fault type | reload << 4 | errno << 8
+#define VMTR_EVICT 2  //victim frame; 1 if written to swap or to its file, 0 if dropped
+#define VMTR_SWAPIN 3 //swap slot; duration in ns
+#define VMTR_SWAPOUT 4 //swap slot; duration in ns
+#define VMTR_TLBINV 5 //invalidated vaddr (0 for the whole TLB); 1 if the whole TLB was flushed
+
+struct vmtrace_event {
+    uint64_t time;   //ns, from the real-time clock
+    uint32_t a;
+    uint32_t b;
+    int16_t pid;     //0 for the kernel
+    uint8_t type;
+    uint8_t cpu;
+    uint32_t pad;
+};
+
+/* layout of the file written by vmtrace_save, followed by nevents events */
+struct vmtrace_header {
+    uint32_t magic;
+    uint32_t evsize;  //sizeof(struct vmtrace_event)
+    uint32_t nevents;
+    uint32_t dropped; //events lost by CPUs without a ring
+};
+
+#if OPT_VMTRACE
+extern volatile bool vmtrace_on;
+
+#define VMTRACE(type, a, b) do { \
+        if (vmtrace_on) \
+            vmtrace_record((type), (uint32_t)(a), (uint32_t)(b)); \
+    } while (0)
+
+void vmtrace_record(unsigned type, uint32_t a, uint32_t b);
+int vmtrace_enable(bool on);
+void vmtrace_dump(void);
+int vmtrace_save(char *path);
+#else
+#define VMTRACE(type, a, b) ((void)0)
+#endif
+#endif
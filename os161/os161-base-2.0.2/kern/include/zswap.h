@@ -0,0 +1,19 @@
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+#include <types.h>
+#include <mips/types.h>
+
+/*
+ * Compressed swap pool: a fixed set of frames reserved from the coremap that
+ * holds evicted pages in compressed form, in front of the swap disk.
+ * Entries are keyed by the swap slot reserved for the page on a swap device,
+ * so a page written back from the pool simply lands in its own slot.
+ *
+ * All the functions below must be called with the swap lock held.
+ */
+void zswap_init(void);
+int zswap_store(unsigned slot, paddr_t paddr);
+int zswap_load(unsigned slot, paddr_t paddr, bool toRemove);
+void zswap_invalidate(unsigned slot);
+#endif
@@ -45,6 +45,20 @@
 #include "opt-net.h"
 #include "opt-waitpid.h"
 #include "opt-args.h"
+#include "opt-paging.h"
+#include "opt-ksm.h"
+#include "opt-vmtrace.h"
+
+#if OPT_PAGING
+#include <swapfile.h>
+#include <vmstats.h>
+#endif
+#if OPT_KSM
+#include <ksm.h>
+#endif
+#if OPT_VMTRACE
+#include <vmtrace.h>
+#endif
 /*
  * In-kernel menu and command dispatcher.
  */
@@ -412,6 +426,166 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_PAGING
+/*
+ * Command for adding a swap device, or listing them with no arguments.
+ */
+static
+int
+cmd_swapon(int nargs, char **args)
+{
+	if (nargs == 1) {
+		swap_print_devs();
+		return 0;
+	}
+	if (nargs > 3) {
+		kprintf("Usage: swapon [device [priority]]\n");
+		return EINVAL;
+	}
+
+	return swapon(args[1], nargs == 3 ? atoi(args[2]) : 0);
+}
+
+/*
+ * Command for setting the swap overcommit policy.
+ */
+static
+int
+cmd_overcommit(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: overcommit 0|1|2 (guess, always, never)\n");
+		return EINVAL;
+	}
+
+	return swap_set_overcommit(atoi(args[1]));
+}
+
+/*
+ * Command for setting the ELF read-ahead window.
+ */
+static
+int
+cmd_elfra(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("ELF read-ahead: %u pages\n", elf_readahead);
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: elfra [pages]\n");
+		return EINVAL;
+	}
+
+	return elf_set_readahead(atoi(args[1]));
+}
+
+/*
+ * Command for setting the maximum size of the user stacks.
+ */
+static
+int
+cmd_stackmax(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("Stack limit: %u pages\n", stack_maxpages);
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: stackmax [pages]\n");
+		return EINVAL;
+	}
+
+	return as_set_stackmax(atoi(args[1]));
+}
+
+/*
+ * Command for setting how many pages each process can lock with mlock.
+ */
+static
+int
+cmd_mlockmax(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("mlock limit: %u pages per process\n", mlock_maxpages);
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: mlockmax [pages]\n");
+		return EINVAL;
+	}
+
+	return as_set_mlockmax(atoi(args[1]));
+}
+
+/*
+ * Command for printing the latency histograms of the VM so far.
+ */
+static
+int
+cmd_vmlat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_lat_print();
+	return 0;
+}
+#endif
+
+#if OPT_KSM
+/*
+ * Command for starting or stopping same-page merging and setting its scan
+ * rate, or printing its state with no arguments.
+ */
+static
+int
+cmd_ksm(int nargs, char **args)
+{
+	bool run;
+
+	if (nargs == 1) {
+		ksm_print();
+		return 0;
+	}
+	if (nargs > 4 || (strcmp(args[1], "on") && strcmp(args[1], "off"))) {
+		kprintf("Usage: ksm [on|off [pages [seconds]]]\n");
+		return EINVAL;
+	}
+	run = !strcmp(args[1], "on");
+
+	return ksm_set(run, nargs > 2 ? (unsigned)atoi(args[2]) : ksm_pages_to_scan,
+		       nargs > 3 ? (unsigned)atoi(args[3]) : ksm_sleep_secs);
+}
+#endif
+
+#if OPT_VMTRACE
+/*
+ * Command for the VM event trace: turn it on or off, print it, or save it
+ * to a file (e.g. on emu0:) for offline analysis.
+ */
+static
+int
+cmd_vmtrace(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		return vmtrace_enable(true);
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		return vmtrace_enable(false);
+	}
+	if (nargs == 2 && !strcmp(args[1], "dump")) {
+		vmtrace_dump();
+		return 0;
+	}
+	if (nargs == 3 && !strcmp(args[1], "save")) {
+		return vmtrace_save(args[2]);
+	}
+	kprintf("Usage: vmtrace on|off|dump|save file\n");
+	return EINVAL;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -451,6 +625,20 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+#if OPT_PAGING
+	"[swapon]  Add/list swap devices     ",
+	"[overcommit] Set overcommit policy  ",
+	"[elfra]   Set ELF read-ahead window ",
+	"[stackmax] Set user stack limit     ",
+	"[mlockmax] Set per-process mlock limit",
+	"[vmlat]   VM latency histograms     ",
+#endif
+#if OPT_KSM
+	"[ksm]     Same-page merging         ",
+#endif
+#if OPT_VMTRACE
+	"[vmtrace] VM event trace            ",
+#endif
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -557,6 +745,20 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+#if OPT_PAGING
+	{ "swapon",	cmd_swapon },
+	{ "overcommit",	cmd_overcommit },
+	{ "elfra",	cmd_elfra },
+	{ "stackmax",	cmd_stackmax },
+	{ "mlockmax",	cmd_mlockmax },
+	{ "vmlat",	cmd_vmlat },
+#endif
+#if OPT_KSM
+	{ "ksm",	cmd_ksm },
+#endif
+#if OPT_VMTRACE
+	{ "vmtrace",	cmd_vmtrace },
+#endif
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -260,8 +260,11 @@ proc_destroy(struct proc *proc)
 			as_deactivate();
 		}
 		else {
+			/* under p_lock, as proc_oom_victim looks at it */
+			spinlock_acquire(&proc->p_lock);
 			as = proc->p_addrspace;
 			proc->p_addrspace = NULL;
+			spinlock_release(&proc->p_lock);
 		}
 		as_destroy(as);
 	}
@@ -472,6 +475,77 @@ proc_signal_end(struct proc *proc)
 #endif
 }
 
+/*
+ * Out of RAM and swap: pick the process with the largest page table
+ * that has not been killed yet, and mark it. It is marked under its
+ * p_lock: once that is dropped its address space may be destroyed at
+ * any time, so the returned pointer must only be compared, never used.
+ */
+struct addrspace *
+proc_oom_victim(void)
+{
+#if OPT_WAITPID && OPT_PAGING
+  struct addrspace *as;
+  struct proc *victim = NULL;
+  unsigned most = 0;
+  int i;
+  spinlock_acquire(&processTable.lk);
+  for (i=1; i<=MAX_PROC; i++) {
+    struct proc *p = processTable.proc[i];
+    if (p == NULL) continue;
+    spinlock_acquire(&p->p_lock);
+    as = p->p_addrspace;
+    if (as != NULL && !as->oom_killed &&
+        (victim == NULL || as->npages > most)) {
+      victim = p;
+      most = as->npages;
+    }
+    spinlock_release(&p->p_lock);
+  }
+  as = NULL;
+  if (victim != NULL) {
+    spinlock_acquire(&victim->p_lock);
+    as = victim->p_addrspace;
+    if (as != NULL)
+      as->oom_killed = 1;
+    spinlock_release(&victim->p_lock);
+  }
+  spinlock_release(&processTable.lk);
+  return as;
+#else
+  struct addrspace *as = proc_getas();
+  if (as != NULL)
+    as->oom_killed = 1;
+  return as;
+#endif
+}
+
+/*
+ * Address space of the next process after *pid in the process table, which
+ * becomes its pid. NULL once the table is over. The caller must keep it from
+ * being destroyed meanwhile, as the reclaims of coremap.c do.
+ */
+struct addrspace *
+proc_next_as(int *pid)
+{
+  struct addrspace *as = NULL;
+#if OPT_WAITPID
+  spinlock_acquire(&processTable.lk);
+  while (as == NULL && ++*pid <= MAX_PROC) {
+    struct proc *p = processTable.proc[*pid];
+    if (p == NULL) continue;
+    spinlock_acquire(&p->p_lock);
+    as = p->p_addrspace;
+    spinlock_release(&p->p_lock);
+  }
+  spinlock_release(&processTable.lk);
+#else
+  if ((*pid)++ == 0)
+    as = proc_getas();
+#endif
+  return as;
+}
+
 #if OPT_FILE
 void 
 proc_file_table_copy(struct proc *psrc, struct proc *pdest) {
@@ -7,6 +7,7 @@
 #include <types.h>
 #include <kern/unistd.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <clock.h>
 #include <syscall.h>
 #include <current.h>
@@ -20,6 +21,8 @@
 #include <limits.h>
 #include <uio.h>
 #include <proc.h>
+#include <addrspace.h>
+#include <elf.h>
 
 /* max num of system wide open files */
 #define SYSTEM_OPEN_MAX (10*OPEN_MAX)
@@ -238,6 +241,39 @@ sys_close(int fd)
   return 0;
 }
 
+#if OPT_PAGING
+/*
+ * Maps the file open as fd, from offset (a multiple of the page size), and
+ * returns the address chosen by the kernel. Writable mappings must be
+ * shared: their dirty pages go back to the file on eviction, munmap or exit,
+ * and all the processes mapping a page of the file share its frame.
+ */
+int
+sys_mmap(size_t len, int prot, int flags, int fd, off_t offset, vaddr_t *retval)
+{
+  struct openfile *of;
+  unsigned rwx = PF_R;
+
+  if (fd<0||fd>=OPEN_MAX) return EBADF;
+  of = curproc->fileTable[fd];
+  if (of==NULL || of->vn==NULL) return EBADF;
+  if (flags != MAP_SHARED && flags != MAP_PRIVATE) return EINVAL;
+  if (prot & PROT_WRITE) {
+    if (flags != MAP_SHARED) return ENOTSUP; // private copies of file pages are not supported
+    rwx |= PF_W;
+  }
+  if (prot & PROT_EXEC)
+    rwx |= PF_X;
+  return as_mmap(proc_getas(), of->vn, len, offset, rwx, retval);
+}
+
+int
+sys_munmap(vaddr_t addr, size_t len)
+{
+  return as_munmap(proc_getas(), addr, len);
+}
+#endif
+
 #endif
 
 /*
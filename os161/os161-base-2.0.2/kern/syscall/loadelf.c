@@ -63,6 +63,7 @@
 #if OPT_PAGING
 #include <kern/fcntl.h>
 #include <vfs.h>
+#include <vmstats.h>
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -298,10 +299,89 @@ int load_elf_ondemand(segment_t* seg, paddr_t paddr, vaddr_t vaddr)
 		paddr += seg->initoffset;
 	}
 	off_t offset = seg->offset + amt ;
+	uint64_t start = vm_lat_now();
 	int result = load_segment(as, as->v, offset, paddr , memsize, filesize, seg->rwx & PF_X);
+	if (result == 0)
+		vm_lat_record(LAT_ELF_LOAD, start);
 	return result;
 
 }
+
+unsigned elf_readahead = 4; //pages read together with a faulting ELF page
+
+int elf_set_readahead(unsigned npages)
+{
+	if (npages > ELF_MAXREADAHEAD)
+		return EINVAL;
+	elf_readahead = npages;
+	return 0;
+}
+
+/*
+ * Number of pages, starting from the one at vaddr and at most max, that
+ * load_elf_cluster can read at once: every page must hold file data, and
+ * the first page of the segment, which may start mid-page, is excluded.
+ */
+unsigned elf_cluster_pages(segment_t *seg, vaddr_t vaddr, unsigned max)
+{
+	size_t amt = (vaddr & PAGE_FRAME) - seg->start;
+	unsigned n = 0;
+
+	if (amt == 0)
+		return 0;
+	while (n < max && amt < seg->filesize && amt < seg->size) {
+		n++;
+		amt += PAGE_SIZE;
+	}
+	return n;
+}
+
+/*
+ * Reads npages consecutive pages of seg, from the one at vaddr, into the
+ * frames in paddrs with a single VOP_READ. npages must not exceed what
+ * elf_cluster_pages allows. The part of the last page past the end of
+ * the file data is zeroed.
+ */
+int load_elf_cluster(segment_t *seg, paddr_t *paddrs, vaddr_t vaddr, unsigned npages)
+{
+	struct addrspace *as = proc_getas();
+	struct iovec iov[ELF_MAXREADAHEAD + 1];
+	struct uio u;
+	size_t amt = (vaddr & PAGE_FRAME) - seg->start;
+	size_t filesize = seg->filesize - amt;
+	int result;
+
+	KASSERT(npages > 0 && npages <= ELF_MAXREADAHEAD + 1);
+	KASSERT(elf_cluster_pages(seg, vaddr, npages) == npages);
+	if (filesize > npages * PAGE_SIZE)
+		filesize = npages * PAGE_SIZE;
+	for (unsigned k = 0; k < npages; k++) {
+		iov[k].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[k]);
+		iov[k].iov_len = PAGE_SIZE;
+	}
+
+	u.uio_iov = iov;
+	u.uio_iovcnt = npages;
+	u.uio_resid = filesize; // amount to read from the file
+	u.uio_offset = seg->offset + amt;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = NULL;
+
+	uint64_t start = vm_lat_now();
+	result = VOP_READ(as->v, &u);
+	if (result)
+		return result;
+	vm_lat_record(LAT_ELF_LOAD, start);
+	if (u.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	if (filesize % PAGE_SIZE != 0)
+		bzero((char *)PADDR_TO_KVADDR(paddrs[npages - 1]) + filesize % PAGE_SIZE, PAGE_SIZE - filesize % PAGE_SIZE);
+	return 0;
+}
 #else
 static
 int
@@ -8,6 +8,7 @@
 #include <types.h>
 #include <kern/unistd.h>
 #include <kern/errno.h>
+#include <kern/vmusage.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -18,6 +19,17 @@
 #include <mips/trapframe.h>
 #include <current.h>
 #include <synch.h>
+#include <vfs.h>
+#include <test.h>
+#include <kern/fcntl.h>
+#include <kern/wait.h>
+#include "opt-vmprofile.h"
+#if OPT_SHM
+#include <shm.h>
+#endif
+#if OPT_VMPROFILE
+#include <vmprofile.h>
+#endif
 
 /*
  * system calls for process management
@@ -25,6 +37,10 @@
 void
 sys__exit(int status)
 {
+#if OPT_PAGING
+  if (proc_getas() != NULL) /* paging done by the process, to find who dominates it */
+    as_print_rusage(proc_getas(), curproc->p_name);
+#endif
 #if OPT_WAITPID
   struct proc *p = curproc;
   p->p_status = status & 0xff; /* just lower 8 bits returned */
@@ -96,13 +112,15 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
 
   /* done here as we need to duplicate the address space 
      of thbe current process */
-  as_copy(curproc->p_addrspace, &(newp->p_addrspace));
-  if(newp->p_addrspace == NULL){
+  result = as_copy(curproc->p_addrspace, &(newp->p_addrspace));
+  if(result){
     proc_destroy(newp); 
-    return ENOMEM; 
+    return result; 
   }
 
-  proc_file_table_copy(newp,curproc);
+#if OPT_FILE
+  proc_file_table_copy(curproc,newp);
+#endif
 
   /* we need a copy of the parent's trapframe */
   tf_child = kmalloc(sizeof(struct trapframe));
@@ -130,4 +148,310 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
 
   return 0;
 }
-#endif
\ No newline at end of file
+#endif
+
+#if OPT_PAGING
+/*
+ * Arguments of a spawned program, packed one after the other (NUL
+ * terminated) by the parent and indexed by the child, which copies them
+ * to its user stack. They stay here rather than on the small kernel stack
+ * of the child while the program is loaded.
+ */
+struct spawn_args {
+  unsigned long nargs;
+  size_t len;
+  char *args[SPAWN_MAXARGS + 1];
+  char buf[SPAWN_ARGMAX];
+};
+
+static void
+call_runprogram(void *sav, unsigned long dummy) {
+  struct spawn_args *sa = sav;
+  unsigned long nargs = sa->nargs, i;
+  vaddr_t entrypoint, stackptr;
+  size_t pos = 0;
+  int result;
+  (void)dummy;
+
+  for (i = 0; i < nargs; i++) {
+    sa->args[i] = &sa->buf[pos];
+    pos += strlen(sa->args[i]) + 1;
+  }
+  sa->args[nargs] = NULL;
+
+  result = loadprogramWithArgs(sa->args, nargs, &entrypoint, &stackptr);
+  if (result) {
+    kprintf("Spawning %s failed: %s\n", sa->args[0], strerror(result));
+    kfree(sa);
+    sys__exit(_MKWAIT_EXIT(result));
+  }
+  /* enter_new_process does not return: nothing must be left to free */
+  kfree(sa);
+  enter_new_process(nargs, (userptr_t)stackptr, NULL /*userspace addr of environment*/,
+                    stackptr - (stackptr % 8), entrypoint);
+}
+
+/*
+ * Starts the program at path in a new process, with the NULL terminated
+ * argv (argv[0] is replaced by path). Unlike fork+exec the memory of the
+ * caller is never copied: the child builds a fresh address space, and
+ * only the file table is inherited.
+ */
+int sys_spawn(userptr_t path, userptr_t argv, pid_t *retval) {
+  struct spawn_args *sa;
+  struct vnode *v;
+  struct proc *newp;
+  char *kpath;
+  size_t actual;
+  int result;
+
+  KASSERT(curproc != NULL);
+
+  sa = kmalloc(sizeof(struct spawn_args));
+  if (sa == NULL)
+    return ENOMEM;
+  result = copyinstr(path, sa->buf, SPAWN_ARGMAX, &actual);
+  if (result)
+    goto fail;
+  sa->nargs = 1;
+  sa->len = actual;
+
+  for (unsigned i = 0; argv != NULL; i++) {
+    userptr_t arg;
+    result = copyin((const_userptr_t)((vaddr_t)argv + i * sizeof(userptr_t)), &arg, sizeof(userptr_t));
+    if (result)
+      goto fail;
+    if (arg == NULL)
+      break;
+    if (i == 0)
+      continue; /* path takes the place of argv[0] */
+    if (sa->nargs == SPAWN_MAXARGS) {
+      result = E2BIG;
+      goto fail;
+    }
+    result = copyinstr(arg, sa->buf + sa->len, SPAWN_ARGMAX - sa->len, &actual);
+    if (result) {
+      if (result == ENAMETOOLONG)
+        result = E2BIG;
+      goto fail;
+    }
+    sa->len += actual;
+    sa->nargs++;
+  }
+
+  /* report a missing program to the caller, not as the exit status of the child */
+  kpath = kstrdup(sa->buf);
+  if (kpath == NULL) {
+    result = ENOMEM;
+    goto fail;
+  }
+  result = vfs_open(kpath, O_RDONLY, 0, &v);
+  kfree(kpath);
+  if (result)
+    goto fail;
+  vfs_close(v);
+
+  newp = proc_create_runprogram(sa->buf);
+  if (newp == NULL) {
+    result = ENOMEM;
+    goto fail;
+  }
+#if OPT_FILE
+  proc_file_table_copy(curproc, newp);
+#endif
+
+  result = thread_fork(sa->buf, newp, call_runprogram, sa, 0);
+  if (result) {
+    proc_destroy(newp);
+    goto fail;
+  }
+
+#if OPT_WAITPID
+  *retval = newp->p_pid;
+#else
+  *retval = 0;
+#endif
+  return 0;
+
+fail:
+  kfree(sa);
+  return result;
+}
+
+/*
+ * Replaces the program of the calling process. The address space structure,
+ * its lock and page table are recycled (see as_reset), and the arguments go
+ * through one EXECV_ARGMAX buffer, already laid out as the argv block of the
+ * new stack so that a single copyout moves it: first the path, then the
+ * pointers (offsets until the final address is known), then the strings.
+ */
+int sys_execv(userptr_t path, userptr_t argv) {
+  struct addrspace *as = proc_getas();
+  struct vnode *v;
+  vaddr_t entrypoint, stackptr;
+  userptr_t arg;
+  char *kbuf, *kpath;
+  size_t actual, pos, base;
+  unsigned nargs, i;
+  int result;
+
+  KASSERT(as != NULL);
+  if (argv == NULL)
+    return EFAULT;
+  kbuf = kmalloc(EXECV_ARGMAX);
+  if (kbuf == NULL)
+    return ENOMEM;
+  result = copyinstr(path, kbuf, EXECV_ARGMAX, &actual);
+  if (result)
+    goto fail;
+  base = ROUNDUP(actual, 8); /* pos is rounded to 8 too: the stack pointer stays 8-aligned */
+
+  for (nargs = 0; ; nargs++) {
+    if (base + (nargs + 1) * sizeof(userptr_t) > EXECV_ARGMAX) {
+      result = E2BIG;
+      goto fail;
+    }
+    result = copyin((const_userptr_t)((vaddr_t)argv + nargs * sizeof(userptr_t)), &arg, sizeof(userptr_t));
+    if (result)
+      goto fail;
+    if (arg == NULL)
+      break;
+  }
+  pos = base + (nargs + 1) * sizeof(userptr_t);
+  vaddr_t *uargv = (vaddr_t *)(kbuf + base);
+  for (i = 0; i < nargs; i++) {
+    result = copyin((const_userptr_t)((vaddr_t)argv + i * sizeof(userptr_t)), &arg, sizeof(userptr_t));
+    if (result == 0 && arg == NULL)
+      result = EFAULT; /* argv changed under us */
+    if (result == 0)
+      result = copyinstr(arg, kbuf + pos, EXECV_ARGMAX - pos, &actual);
+    if (result) {
+      if (result == ENAMETOOLONG)
+        result = E2BIG;
+      goto fail;
+    }
+    uargv[i] = pos - base;
+    pos += actual;
+  }
+  pos = ROUNDUP(pos, 8);
+  if (pos > EXECV_ARGMAX) {
+    result = E2BIG;
+    goto fail;
+  }
+  uargv[nargs] = 0;
+
+  kpath = kstrdup(kbuf);
+  if (kpath == NULL) {
+    result = ENOMEM;
+    goto fail;
+  }
+  result = vfs_open(kbuf, O_RDONLY, 0, &v);
+  if (result) {
+    kfree(kpath);
+    goto fail;
+  }
+
+  /* point of no return: the old program is gone */
+  as_reset(as, v, kpath);
+  as_activate();
+  result = load_elf(v, &entrypoint);
+  if (result == 0)
+    result = as_define_stack(as, &stackptr);
+  if (result == 0) {
+    stackptr -= pos - base;
+    for (i = 0; i < nargs; i++)
+      uargv[i] += stackptr;
+    result = copyout(kbuf + base, (userptr_t)stackptr, pos - base);
+  }
+  kfree(kbuf);
+  if (result) {
+    kprintf("execv of %s failed: %s\n", as->progname, strerror(result));
+    sys__exit(_MKWAIT_EXIT(result));
+  }
+#if OPT_VMPROFILE
+  vmprofile_start(as);
+#endif
+
+  enter_new_process(nargs, (userptr_t)stackptr, NULL /*userspace addr of environment*/,
+                    stackptr, entrypoint);
+
+  /* enter_new_process does not return. */
+  panic("enter_new_process returned\n");
+  return EINVAL;
+
+fail:
+  kfree(kbuf);
+  return result;
+}
+
+/*
+ * Moves the program break by amount bytes and returns the old break.
+ * The new heap pages cost nothing until they are touched.
+ */
+int sys_sbrk(intptr_t amount, vaddr_t *retval) {
+  struct addrspace *as = proc_getas();
+
+  if (as == NULL)
+    return EINVAL;
+  return as_sbrk(as, amount, retval);
+}
+
+int sys_madvise(vaddr_t addr, size_t len, int advice) {
+  struct addrspace *as = proc_getas();
+
+  if (as == NULL)
+    return EINVAL;
+  return as_madvise(as, addr, len, advice);
+}
+
+int sys_mlock(vaddr_t addr, size_t len) {
+  struct addrspace *as = proc_getas();
+
+  if (as == NULL)
+    return EINVAL;
+  return as_mlock(as, addr, len);
+}
+
+int sys_munlock(vaddr_t addr, size_t len) {
+  struct addrspace *as = proc_getas();
+
+  if (as == NULL)
+    return EINVAL;
+  return as_munlock(as, addr, len);
+}
+
+/* paging counters of the calling process, a struct vm_rusage */
+int sys_getvmusage(int who, userptr_t ru) {
+  struct addrspace *as = proc_getas();
+  struct vm_rusage usage;
+
+  if (as == NULL || who != RUSAGE_SELF)
+    return EINVAL;
+  as_getrusage(as, &usage);
+  return copyout(&usage, ru, sizeof(usage));
+}
+
+#if OPT_SHM
+/*
+ * Shared memory: shmget returns the id of the object with the given key
+ * (SHM_PRIVATE always creates one), shmat maps it where the kernel finds
+ * room and returns the address, shmdt unmaps it, shmrm removes the object
+ * once the last process detaches.
+ */
+int sys_shmget(int key, size_t size, int *retval) {
+  return shm_get(key, size, retval);
+}
+
+int sys_shmat(int id, vaddr_t *retval) {
+  return as_shmat(proc_getas(), id, retval);
+}
+
+int sys_shmdt(vaddr_t addr) {
+  return as_shmdt(proc_getas(), addr);
+}
+
+int sys_shmrm(int id) {
+  return shm_remove(id);
+}
+#endif
+#endif
@@ -48,6 +48,10 @@
 
 #if OPT_PAGING
 #include <copyinout.h>
+#include "opt-vmprofile.h"
+#if OPT_VMPROFILE
+#include <vmprofile.h>
+#endif
 /*
  * Load program "progname" and start running it in usermode.
  * Does not return except on error.
@@ -99,6 +103,10 @@ runprogram(char *progname)
 		return result;
 	}
 
+#if OPT_VMPROFILE
+	vmprofile_start(as); //warm up the pages of the last startup, or record them
+#endif
+
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
 			  NULL /*userspace addr of environment*/,
@@ -109,7 +117,12 @@ runprogram(char *progname)
 	return EINVAL;
 }
 
-int runprogramWithArgs(char **args, unsigned long nargs)
+/*
+ * Loads the program args[0] into a new address space and copies the
+ * arguments to its stack, leaving the process ready to enter user mode.
+ * The arguments are no longer needed once this returns.
+ */
+int loadprogramWithArgs(char **args, unsigned long nargs, vaddr_t *entrypointp, vaddr_t *stackptrp)
 {
 	struct addrspace *as;
 	//struct vnode *v;
@@ -153,6 +166,10 @@ int runprogramWithArgs(char **args, unsigned long nargs)
 		return result;
 	}
 
+#if OPT_VMPROFILE
+	vmprofile_start(as); //warm up the pages of the last startup, or record them
+#endif
+
 	size_t sz = 0,strsize = 0,strsizeround = 0,actual;
 	int i;
 	vaddr_t addrargs[nargs+1];
@@ -183,6 +200,19 @@ int runprogramWithArgs(char **args, unsigned long nargs)
 			return err;
 	}
 
+	*entrypointp = entrypoint;
+	*stackptrp = stackptr;
+	return 0;
+}
+
+int runprogramWithArgs(char **args, unsigned long nargs)
+{
+	vaddr_t entrypoint, stackptr;
+
+	int result = loadprogramWithArgs(args, nargs, &entrypoint, &stackptr);
+	if (result)
+		return result;
+
 	enter_new_process(nargs, (userptr_t) (stackptr),
 			  NULL /*userspace addr of environment*/,
 			  stackptr - (stackptr % 8), entrypoint);
@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <addrspace.h>
 #include <vm.h>
@@ -48,8 +49,44 @@
 #include <vm_tlb.h>
 #include <vmstats.h>
 #include <kern/fcntl.h>
+#include <stat.h>
+#include <uio.h>
+#include <vnode.h>
 #include <synch.h>
-#define STACKPAGES 18
+#include <thread.h>
+#include <syscall.h>
+#include <kern/signal.h>
+#include <kern/wait.h>
+#include "opt-zswap.h"
+#if OPT_ZSWAP
+#include <zswap.h>
+#endif
+#include "opt-pagecache.h"
+#if OPT_PAGECACHE
+#include <pagecache.h>
+#endif
+#include "opt-shm.h"
+#if OPT_SHM
+#include <shm.h>
+#endif
+#include "opt-ksm.h"
+#if OPT_KSM
+#include <ksm.h>
+#endif
+#include <vmtrace.h>
+#include "opt-vmprofile.h"
+#if OPT_VMPROFILE
+#include <vmprofile.h>
+#endif
+#define STACK_INITPAGES 2  //pages the stack starts with, it grows on faults below it
+#define STACK_GUARDPAGES 4 //unmapped gap always kept between the heap and the stack
+
+unsigned stack_maxpages = 256; //limit of the stack growth
+unsigned mlock_maxpages = 32; //pages each process can lock
+static paddr_t zero_frame; //reserved and always zero, mapped by pages only read so far
+
+static int as_index_segments(struct addrspace *as, unsigned *npages);
+static segment_t *as_find_segment(struct addrspace *as, vaddr_t vaddr);
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -89,12 +126,25 @@ as_create(char *prog_name, int *retVal)
 	}
 	/* Open the file. */
 	if(vfs_open(prog_name, O_RDONLY, 0, &(as->v))) {
+		kfree(as);
 		*retVal = ENOENT;
 		return NULL;
 	}
 	as->progname = kstrdup(prog_name);
 	as->as_segment = NULL;
+	as->as_segidx = NULL;
+	as->nsegs = 0;
+	as->heap = NULL;
+	as->stack = NULL;
+	as->brk = 0;
 	as->as_pt = NULL;
+	as->npages = 0;
+	as->ptcap = 0;
+	as->reserved = 0;
+	as->oom_killed = 0;
+	as->profile = NULL;
+	as->nlocked = 0;
+	bzero(&as->ru, sizeof(as->ru));
 	as->pt_lock = lock_create("PT_lock");
 	if(as->pt_lock  == NULL) {
 		kprintf("Page Table Lock was not created succesfully\n");
@@ -103,6 +153,9 @@ as_create(char *prog_name, int *retVal)
 		*retVal = ENOMEM;
 		return NULL;
 	}
+#if OPT_KSM
+	ksm_register(as);
+#endif
 	*retVal = 0;
 	return as;
 }
@@ -122,23 +175,43 @@ int as_copy(struct addrspace *old, struct addrspace **ret)
 	{
 		return err;
 	}
+	if (swap_reserve(old->reserved)) //fail the fork now rather than running out of swap later
+	{
+		as_destroy(newas);
+		return ENOMEM;
+	}
+	newas->reserved = old->reserved;
+
 	lock_acquire(old->pt_lock);
-	segment_t *seg, *new_seg, *curseg;
+	segment_t *seg, *new_seg, *curseg = NULL;
 	
 	for (seg = old->as_segment; seg != NULL; seg = seg->next)
 	{
 		new_seg = (segment_t *)kmalloc(sizeof(segment_t));
 		if (new_seg == NULL)
-			return ENOMEM; 
+		{
+			err = ENOMEM;
+			goto fail;
+		}
 		
 		new_seg->start = seg->start;
 		new_seg->size = seg->size;
 		new_seg->filesize = seg->filesize;
 		new_seg->npages = seg->npages;
 		new_seg->rwx = seg->rwx;
+		new_seg->type = seg->type;
 		new_seg->offset = seg->offset;
 		new_seg->initoffset = seg->initoffset;
+		new_seg->ptbase = seg->ptbase;
+		new_seg->vn = seg->vn;
+		new_seg->shm = seg->shm; //attached below, out of pt_lock
+		if (seg->type == SEG_MMAP)
+			VOP_INCREF(seg->vn);
 		new_seg->next = NULL;
+		if (seg == old->heap)
+			newas->heap = new_seg;
+		if (seg == old->stack)
+			newas->stack = new_seg;
 
 		if (newas->as_segment == NULL)
 		{
@@ -151,78 +224,212 @@ int as_copy(struct addrspace *old, struct addrspace **ret)
 		curseg = new_seg;
 	}
 
+	unsigned npages;
+	err = as_index_segments(newas, &npages);
+	if (err)
+		goto fail;
+	KASSERT(npages == old->npages);
+
+	paddr_t ptloc = ptAlloc(old->npages);
+	if(ptloc == 0)
+	{
+		err = ENOMEM;
+		goto fail;
+	}
+	newas->as_pt = (pt_entry *)PADDR_TO_KVADDR(ptloc);
+	newas->ptcap = PT_CAPACITY(old->npages);
 	newas->npages = old->npages;
-	
-	paddr_t ptloc = ptAlloc(newas->npages);
-	if(ptloc)
-		newas->as_pt = (pt_entry *)PADDR_TO_KVADDR(ptloc);
-	else
-		return ENOMEM;
+	newas->brk = old->brk;
+	bzero(newas->as_pt, sizeof(pt_entry) * newas->npages); //as_destroy can clean up a partial copy
 
 	pt_entry *tmp;
-	paddr_t paddr;
 
 	for(unsigned i = 0 ; i < newas->npages ; i++)
 	{
 		tmp = &newas->as_pt[i];
 		tmp->in_mem = 0;
 		tmp->in_swap = 0;
+		tmp->zero_fill = old->as_pt[i].zero_fill;
 		tmp->rwx = old->as_pt[i].rwx;
 		tmp->vaddr = old->as_pt[i].vaddr;
-		paddr = 0;
-		if(old->as_pt[i].in_swap) {
-			paddr = getPages(1,tmp->vaddr,newas);
-			err = swap_in(&(tmp->paddr), paddr, false);
-			if(err)
-				return err;
-			tmp->in_swap = 0;
+		tmp->paddr = 0;
+		tmp->mapped = old->as_pt[i].mapped;
+		tmp->advice = old->as_pt[i].advice;
+		tmp->shm = old->as_pt[i].shm;
+		if(old->as_pt[i].shm) //the child finds the frame through the object
+			continue;
+		if(old->as_pt[i].mapped) { //the child finds the page cached, or reads the file again with the parent's writes in it
+			if(old->as_pt[i].dirty && as_mmap_writeback(old, &old->as_pt[i]) == 0)
+				old->as_pt[i].dirty = 0;
+			continue;
+		}
+#if OPT_PAGECACHE
+		if(old->as_pt[i].in_mem && old->as_pt[i].shared) { //same binary, same cached frame
+			pagecache_ref(old->as_pt[i].paddr);
+			tmp->paddr = old->as_pt[i].paddr;
+			tmp->shared = 1;
 			tmp->in_mem = 1;
-
-		} else if(old->as_pt[i].in_mem) {
-			paddr = getPages(1,tmp->vaddr,newas);
-			memmove((void *)PADDR_TO_KVADDR(paddr),(const void *)PADDR_TO_KVADDR(old->as_pt[i].paddr),PAGE_SIZE);
-			tmp->paddr = paddr;
+			as_rss_add(newas, 1);
+			continue;
+		}
+#endif
+		if(old->as_pt[i].in_mem && old->as_pt[i].zero) { //nothing to share but the zero frame
+			tmp->paddr = zero_frame;
+			tmp->zero = 1;
 			tmp->in_mem = 1;
-		} else {
-			tmp->paddr = 0;
+			continue;
+		}
+		if(old->as_pt[i].in_mem && old->as_pt[i].locked) { //stays pinned and private, the child gets a copy
+			paddr_t copy = getPages(1, tmp->vaddr, NULL); //free frames only, old->pt_lock is held
+			if (copy == 0)
+			{
+				err = ENOMEM;
+				goto fail;
+			}
+			setPageOwner(copy, newas);
+			memmove((void *)PADDR_TO_KVADDR(copy), (const void *)PADDR_TO_KVADDR(old->as_pt[i].paddr), PAGE_SIZE);
+			tmp->paddr = copy;
+			tmp->in_mem = 1;
+			as_rss_add(newas, 1);
+			continue;
+		}
+		if(old->as_pt[i].in_mem && !(old->as_pt[i].rwx & 2)) //never written, the child reads it again
+			continue;
+		if(old->as_pt[i].in_mem) { //share the frame until one of the two writes to it
+			sharePage(old->as_pt[i].paddr, true);
+			old->as_pt[i].cow = 1;
+			tmp->paddr = old->as_pt[i].paddr;
+			tmp->cow = 1;
+			tmp->in_mem = 1;
+			as_rss_add(newas, 1);
+		} else if(old->as_pt[i].in_swap) { //both refer to the slot, the first to fault reads it
+			swap_dup(old->as_pt[i].paddr);
+			tmp->paddr = old->as_pt[i].paddr;
+			tmp->in_swap = 1;
 		}
-
 	}
-	*ret = newas;
+	if (proc_getas() == old)
+		tlb_invalidate(); //the parent may still hold writable entries for its pages
 	lock_release(old->pt_lock);
+#if OPT_SHM
+	for (seg = newas->as_segment; seg != NULL; seg = seg->next)
+	{
+		if (seg->type != SEG_SHM)
+			continue;
+		err = shm_attach_object(seg->shm, newas, seg->start);
+		if (err)
+		{
+			as_destroy(newas);
+			return err;
+		}
+	}
+#endif
+	*ret = newas;
 	return 0;
+
+fail:
+	lock_release(old->pt_lock);
+	as_destroy(newas);
+	return err;
 }
 
 /*
  *    as_destroy - dispose of an address space. You may need to change
  *                the way this works if implementing user-level threads.
  */
-void as_destroy(struct addrspace *as)
+/*
+ * Releases the memory of the program running in as: segments, frames, swap
+ * slots and reservation. The structure, its lock and the page table frames
+ * are left to the caller.
+ */
+static void as_release(struct addrspace *as)
 {
-	can_sleep();
-	
-	vfs_close(as->v);
-
+#if OPT_VMPROFILE
+	vmprofile_save(as);
+#endif
 	segment_t *seg, *seg_new;
-	for (seg = as->as_segment, seg_new = as->as_segment; seg_new != NULL; seg = seg_new)
+#if OPT_SHM
+	for (seg = as->as_segment; seg != NULL; seg = seg->next)
 	{
-		seg_new = seg->next;
-		kfree(seg);
+		if (seg->type == SEG_SHM)
+			shm_detach(seg->shm, as); //takes our pt_lock, so not under it
 	}
+#endif
 	lock_acquire(as->pt_lock);
 	pt_entry *pt = as->as_pt;
 	for (unsigned i=0; i<as->npages; i++)
 	{
+		if (pt[i].in_mem && pt[i].dirty)
+			as_mmap_writeback(as, &pt[i]); //shared mappings reach the file before the frame goes
+		if (pt[i].locked)
+			vm_stats_inc(PAGES_UNLOCKED); //the frame is released by freeAs, pinned or not
 		if (pt[i].in_swap)
 			clear_swap(pt[i].paddr);
+		else if (pt[i].in_mem && (pt[i].cow || pt[i].shm))
+			putSharedPage(pt[i].paddr);
+#if OPT_PAGECACHE
+		else if (pt[i].in_mem && pt[i].shared)
+			pagecache_put(pt[i].paddr);
+#endif
 	}
+	as->npages = 0;
+	as->nlocked = 0;
+	as->ru.ru_rss = 0;
 	lock_release(as->pt_lock);
-	lock_destroy(as->pt_lock);
-	freepages((paddr_t)as->as_pt - MIPS_KSEG0);
+	for (seg = as->as_segment, seg_new = as->as_segment; seg_new != NULL; seg = seg_new)
+	{
+		seg_new = seg->next;
+		if (seg->type == SEG_MMAP)
+			VOP_DECREF(seg->vn);
+		kfree(seg);
+	}
+	as->as_segment = NULL;
+	if (as->as_segidx != NULL)
+		kfree(as->as_segidx);
+	as->as_segidx = NULL;
+	as->nsegs = 0;
+	as->heap = NULL;
+	as->stack = NULL;
+	as->brk = 0;
 	freeAs(as);
+	swap_unreserve(as->reserved);
+	as->reserved = 0;
+}
+
+void as_destroy(struct addrspace *as)
+{
+	can_sleep();
+
+#if OPT_KSM
+	ksm_forget(as); //waits for a scan looking at as
+#endif
+	as_release(as);
+	reclaimWait(); //a reclaim may still be looking at the page table
+	vfs_close(as->v);
+	lock_destroy(as->pt_lock);
+	if (as->as_pt != NULL)
+		freepages((paddr_t)as->as_pt - MIPS_KSEG0);
+	kfree(as->progname);
 	kfree(as);
 }
 
+/*
+ * Empties as to load the program v (already open) into it, for execv.
+ * The structure, its lock and the page table frames are recycled: the
+ * table is reallocated by as_prepare_load only if the new program needs
+ * more entries than it holds. Takes ownership of progname.
+ */
+void as_reset(struct addrspace *as, struct vnode *v, char *progname)
+{
+	can_sleep();
+
+	as_release(as);
+	vfs_close(as->v);
+	as->v = v;
+	kfree(as->progname);
+	as->progname = progname;
+}
+
 /*
  *    as_activate - make curproc's address space the one currently
  *                "seen" by the processor.
@@ -292,6 +499,10 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize, size_t
 	seg->filesize = filesize;
 	seg->npages = memsize / PAGE_SIZE;
 	seg->rwx = (readable & 0x4) | (writeable & 0x2) | (executable & 0x1);
+	seg->type = SEG_ELF;
+	seg->ptbase = 0;
+	seg->vn = NULL;
+	seg->shm = NULL;
 	seg->offset = offset;
 	seg->initoffset = vaddr & ~(vaddr_t)PAGE_FRAME;
 	if (as->as_segment == NULL)
@@ -308,31 +519,129 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize, size_t
 	return 0;
 }
 
+/*
+ * Sorts the segment list by address, records each segment's first page
+ * table entry (the table follows the same order) and builds the array used
+ * by vm_fault for its binary search. Returns ENOEXEC if segments overlap.
+ */
+static int as_index_segments(struct addrspace *as, unsigned *npages)
+{
+	segment_t *sorted = NULL, *seg, *next, **link, **idx;
+	unsigned nsegs = 0, np = 0, k = 0;
+
+	for (seg = as->as_segment; seg != NULL; seg = next)
+	{
+		next = seg->next;
+		for (link = &sorted; *link != NULL && (*link)->start < seg->start; link = &(*link)->next);
+		seg->next = *link;
+		*link = seg;
+		nsegs++;
+	}
+	as->as_segment = sorted;
+
+	idx = kmalloc(nsegs * sizeof(segment_t *));
+	if (idx == NULL)
+		return ENOMEM;
+	for (seg = sorted; seg != NULL; seg = seg->next)
+	{
+		if (seg->next != NULL && seg->start + seg->size > seg->next->start)
+		{
+			kfree(idx);
+			return ENOEXEC;
+		}
+		seg->ptbase = np;
+		np += seg->npages;
+		idx[k++] = seg;
+	}
+	if (as->as_segidx != NULL)
+		kfree(as->as_segidx);
+	as->as_segidx = idx;
+	as->nsegs = nsegs;
+	*npages = np;
+	return 0;
+}
+
+//binary search of the segment holding vaddr, NULL if it is outside all of them
+static segment_t *as_find_segment(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo = 0, hi = as->nsegs;
+
+	while (lo < hi)
+	{ //first segment starting above vaddr
+		unsigned mid = (lo + hi) / 2;
+		if (vaddr < as->as_segidx[mid]->start)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if (lo == 0)
+		return NULL;
+	segment_t *seg = as->as_segidx[lo - 1];
+	return vaddr - seg->start < seg->size ? seg : NULL;
+}
+
+//defines a writable region backed by zero-filled pages, returns its segment
+static segment_t *as_define_anon(struct addrspace *as, vaddr_t vaddr, size_t size, unsigned type)
+{
+	segment_t *seg;
+
+	if (as_define_region(as, vaddr, size, 0, PF_R, PF_W, 0, 0) != 0)
+		return NULL;
+	for (seg = as->as_segment; seg->next != NULL; seg = seg->next);
+	seg->type = type;
+	return seg;
+}
+
 /*
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  */
 int as_prepare_load(struct addrspace *as)
 {
-	size_t size = STACKPAGES * PAGE_SIZE;
-	if (as_define_region(as, USERSTACK - size, size, size, PF_R, PF_W, 0, 0) != 0)
-		return ENOMEM;
 	segment_t *curseg;	
+	vaddr_t heapstart = 0;
+	for (curseg = as->as_segment; curseg != NULL; curseg = curseg->next)
+	{
+		if (curseg->start + curseg->size > heapstart)
+			heapstart = curseg->start + curseg->size;
+	}
+	//the heap starts empty, sbrk adds its pages
+	as->heap = as_define_anon(as, heapstart, 0, SEG_HEAP);
+	as->brk = heapstart;
+	as->stack = as_define_anon(as, USERSTACK - STACK_INITPAGES * PAGE_SIZE, STACK_INITPAGES * PAGE_SIZE, SEG_STACK);
+	if (as->heap == NULL || as->stack == NULL)
+		return ENOMEM;
 	vaddr_t v;
-	as->npages = 0;
+	unsigned npages, wpages = 0;
+	int result = as_index_segments(as, &npages);
+	if (result)
+		return result;
 	for (curseg = as->as_segment; curseg != NULL; curseg = curseg->next)
 	{
-		as->npages+=curseg->npages;
+		if (curseg->rwx & 2)
+			wpages+=curseg->npages; //only writable pages can end up in swap
 	}
+	if (swap_reserve(wpages)) //fail the exec now rather than running out of swap later
+		return ENOMEM;
+	as->reserved = wpages;
 
 	lock_acquire(as->pt_lock);
 
-	paddr_t ptloc = ptAlloc(as->npages);
-	
-	if(ptloc)
+	if (as->as_pt == NULL || npages > as->ptcap)
+	{ //after an execv the old table is reused when it is large enough
+		if (as->as_pt != NULL)
+			freepages((paddr_t)as->as_pt - MIPS_KSEG0);
+		as->as_pt = NULL;
+		as->ptcap = 0;
+		paddr_t ptloc = ptAlloc(npages);
+		if(ptloc == 0) {
+			lock_release(as->pt_lock);
+			return ENOMEM;
+		}
 		as->as_pt = (pt_entry *)PADDR_TO_KVADDR(ptloc);
-	else
-		return ENOMEM;
+		as->ptcap = PT_CAPACITY(npages);
+	}
+	as->npages = npages;
 	bzero(as->as_pt, sizeof(pt_entry)* as->npages);
 	int j = 0;
 	pt_entry *pt = as->as_pt;
@@ -347,6 +656,10 @@ int as_prepare_load(struct addrspace *as)
 			pt[j].vaddr = v;
 			pt[j].in_mem = 0;
 			pt[j].in_swap = 0;
+			pt[j].zero_fill = 0;
+			pt[j].shared = 0;
+			pt[j].cow = 0;
+			pt[j].readahead = 0;
 			v += PAGE_SIZE;
 			pt[j].rwx = curseg->rwx;
 			j++;
@@ -356,6 +669,653 @@ int as_prepare_load(struct addrspace *as)
 	return 0;
 }
 
+/*
+ * Adds delta pages to an anonymous segment, below its start if vaddr is
+ * there, otherwise at its end. They only get a page table entry here, the
+ * frame is zero-filled at the first fault. The entries of the segments
+ * above move up, into a larger table if the current one is full.
+ */
+static int as_grow_segment(struct addrspace *as, segment_t *grown, vaddr_t vaddr, unsigned delta)
+{
+	segment_t *seg;
+	unsigned at = grown->ptbase;
+	//mapped pages go back to the file, shared memory is reserved by its object
+	unsigned reserve = grown->type == SEG_MMAP || grown->type == SEG_SHM ? 0 : delta;
+
+	if (vaddr < grown->start)
+		vaddr = grown->start - delta * PAGE_SIZE;
+	else
+	{
+		vaddr = grown->start + grown->size;
+		at += grown->npages;
+	}
+
+	if (swap_reserve(reserve))
+		return ENOMEM;
+	lock_acquire(as->pt_lock);
+	if (as->npages + delta > as->ptcap)
+	{
+		paddr_t ptloc = ptAlloc(as->npages + delta);
+		if (ptloc == 0)
+		{
+			lock_release(as->pt_lock);
+			swap_unreserve(reserve);
+			return ENOMEM;
+		}
+		memcpy((void *)PADDR_TO_KVADDR(ptloc), as->as_pt, sizeof(pt_entry) * as->npages);
+		freepages((paddr_t)as->as_pt - MIPS_KSEG0);
+		as->as_pt = (pt_entry *)PADDR_TO_KVADDR(ptloc);
+		as->ptcap = PT_CAPACITY(as->npages + delta);
+	}
+	pt_entry *pt = as->as_pt;
+	memmove(&pt[at + delta], &pt[at], sizeof(pt_entry) * (as->npages - at));
+	bzero(&pt[at], sizeof(pt_entry) * delta);
+	for (unsigned k = 0; k < delta; k++)
+	{
+		pt[at + k].vaddr = vaddr + k * PAGE_SIZE;
+		pt[at + k].rwx = grown->rwx;
+		pt[at + k].mapped = grown->type == SEG_MMAP;
+		pt[at + k].shm = grown->type == SEG_SHM;
+	}
+	for (seg = grown->next; seg != NULL; seg = seg->next)
+		seg->ptbase += delta;
+	if (vaddr < grown->start)
+		grown->start = vaddr;
+	grown->npages += delta;
+	grown->size += delta * PAGE_SIZE;
+	as->npages += delta;
+	as->reserved += reserve;
+	lock_release(as->pt_lock);
+	return 0;
+}
+
+/*
+ * Empties a page table entry, releasing its frame or swap slot. Dirty pages
+ * of a file mapping are written back first. The next fault finds the page as
+ * it was never touched: loaded again or zero-filled. pt_lock must be held.
+ */
+static void as_drop_page(struct addrspace *as, pt_entry *pte)
+{
+	if (pte->in_mem && pte->dirty)
+		as_mmap_writeback(as, pte);
+	if (pte->in_swap)
+		clear_swap(pte->paddr);
+	else if (pte->in_mem && (pte->cow || pte->shm))
+		putSharedPage(pte->paddr);
+#if OPT_PAGECACHE
+	else if (pte->in_mem && pte->shared)
+		pagecache_put(pte->paddr);
+#endif
+	else if (pte->in_mem && !pte->zero)
+		freepages(pte->paddr);
+	if (pte->in_mem && !pte->zero)
+		as_rss_add(as, -1);
+	if (pte->in_mem)
+		tlb_invalidate_vaddr(pte->vaddr);
+	if (pte->locked)
+	{ //a freed frame is no longer pinned
+		pte->locked = 0;
+		as->nlocked--;
+		vm_stats_inc(PAGES_UNLOCKED);
+	}
+	pte->paddr = 0;
+	pte->in_mem = 0;
+	pte->in_swap = 0;
+	pte->zero_fill = 0;
+	pte->shared = 0;
+	pte->cow = 0;
+	pte->zero = 0;
+	pte->readahead = 0;
+	pte->dirty = 0;
+}
+
+/*
+ * Drops the last delta pages of a segment, with their frames and swap slots.
+ */
+static void as_shrink_segment(struct addrspace *as, segment_t *shrunk, unsigned delta)
+{
+	segment_t *seg;
+	unsigned at = shrunk->ptbase + shrunk->npages - delta;
+	unsigned reserve = shrunk->type == SEG_MMAP || shrunk->type == SEG_SHM ? 0 : delta;
+
+	lock_acquire(as->pt_lock);
+	pt_entry *pt = as->as_pt;
+	for (unsigned k = at; k < at + delta; k++)
+		as_drop_page(as, &pt[k]);
+	memmove(&pt[at], &pt[at + delta], sizeof(pt_entry) * (as->npages - at - delta));
+	for (seg = shrunk->next; seg != NULL; seg = seg->next)
+		seg->ptbase -= delta;
+	shrunk->npages -= delta;
+	shrunk->size -= delta * PAGE_SIZE;
+	as->npages -= delta;
+	as->reserved -= reserve;
+	lock_release(as->pt_lock);
+	swap_unreserve(reserve);
+}
+
+/*
+ * Moves the break of as by amount bytes and hands back the previous one.
+ * The heap cannot go below its start or into the guard gap under the stack.
+ */
+int as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+	segment_t *heap = as->heap;
+	vaddr_t newbrk = as->brk + amount;
+	int result = 0;
+
+	if (heap == NULL)
+		return EINVAL;
+	if (amount < 0 && (newbrk > as->brk || newbrk < heap->start))
+		return EINVAL;
+	if (amount > 0 && (newbrk < as->brk || newbrk > heap->next->start - STACK_GUARDPAGES * PAGE_SIZE))
+		return ENOMEM; //the stack or a file mapping
+
+	unsigned npages = DIVROUNDUP(newbrk - heap->start, PAGE_SIZE);
+	if (npages > heap->npages)
+		result = as_grow_segment(as, heap, newbrk, npages - heap->npages);
+	else if (npages < heap->npages)
+		as_shrink_segment(as, heap, heap->npages - npages);
+	if (result)
+		return result;
+	*oldbrk = as->brk;
+	as->brk = newbrk;
+	return 0;
+}
+
+/*
+ * Fault below the stack: extends it down to vaddr if that stays within
+ * stack_maxpages and leaves the guard gap above the heap. Returns EFAULT
+ * for any other address.
+ */
+static int as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	segment_t *stack = as->stack;
+
+	if (stack == NULL || vaddr >= stack->start)
+		return EFAULT;
+	if (vaddr < USERSTACK - stack_maxpages * PAGE_SIZE)
+		return EFAULT;
+	segment_t *below = as->as_segidx[as->nsegs - 2]; //the heap, or the lowest file mapping
+	if (vaddr < below->start + below->size + STACK_GUARDPAGES * PAGE_SIZE)
+		return EFAULT;
+	int result = as_grow_segment(as, stack, vaddr, (stack->start - vaddr) / PAGE_SIZE);
+	if (result == 0)
+		vm_stats_inc(STACK_GROWTH);
+	return result;
+}
+
+int as_set_stackmax(unsigned npages)
+{
+	if (npages < STACK_INITPAGES || npages > USERSTACK / PAGE_SIZE / 2)
+		return EINVAL;
+	stack_maxpages = npages;
+	return 0;
+}
+
+//reads or writes the page of a file mapping at vaddr, the part past the end of the file is left out
+static int vm_mmap_io(segment_t *seg, paddr_t paddr, vaddr_t vaddr, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct stat st;
+	char *kbuf = (char *)PADDR_TO_KVADDR(paddr);
+	off_t offset = seg->offset + (vaddr - seg->start);
+	size_t len = PAGE_SIZE;
+
+	int result = VOP_STAT(seg->vn, &st);
+	if (result)
+		return result;
+	if (offset >= st.st_size)
+		len = 0;
+	else if (st.st_size - offset < PAGE_SIZE)
+		len = st.st_size - offset;
+	if (rw == UIO_READ)
+		bzero(kbuf + len, PAGE_SIZE - len);
+	if (len == 0)
+		return 0;
+
+	uio_kinit(&iov, &ku, kbuf, len, offset, rw);
+	result = rw == UIO_READ ? VOP_READ(seg->vn, &ku) : VOP_WRITE(seg->vn, &ku);
+	if (result)
+		return result;
+	if (ku.uio_resid != 0)
+	{
+		if (rw == UIO_WRITE)
+			return EIO;
+		bzero(kbuf + len - ku.uio_resid, ku.uio_resid); //the file shrank meanwhile
+	}
+	return 0;
+}
+
+/*
+ * Writes a dirty page of a shared file mapping back to the file. Called with
+ * pt_lock held, the caller clears the dirty bit.
+ */
+int as_mmap_writeback(struct addrspace *as, pt_entry *pte)
+{
+	segment_t *seg = as_find_segment(as, pte->vaddr);
+
+	KASSERT(seg != NULL && seg->type == SEG_MMAP);
+	KASSERT(pte->in_mem);
+	vm_stats_inc(MMAP_WRITEBACK);
+	return vm_mmap_io(seg, pte->paddr, pte->vaddr, UIO_WRITE);
+}
+
+//reads the page of the file mapping seg at vaddr into paddr, for the page cache
+int as_mmap_fill(segment_t *seg, paddr_t paddr, vaddr_t vaddr)
+{
+	return vm_mmap_io(seg, paddr, vaddr, UIO_READ);
+}
+
+//takes an empty segment out of the list and of the index, without allocating
+static void as_unlink_segment(struct addrspace *as, segment_t *seg)
+{
+	segment_t **link;
+	unsigned k;
+
+	KASSERT(seg->npages == 0);
+	lock_acquire(as->pt_lock); //shared memory reclaim looks segments up from other threads
+	for (link = &as->as_segment; *link != seg; link = &(*link)->next);
+	*link = seg->next;
+	for (k = 0; k < as->nsegs && as->as_segidx[k] != seg; k++);
+	if (k < as->nsegs)
+	{ //otherwise the index was never rebuilt with it
+		memmove(&as->as_segidx[k], &as->as_segidx[k + 1], (as->nsegs - k - 1) * sizeof(segment_t *));
+		as->nsegs--;
+	}
+	lock_release(as->pt_lock);
+}
+
+/*
+ * Creates a segment of npages in the highest free range below the limit of
+ * the stack growth and above the heap guard gap. It gets its page table
+ * entries now and its frames on demand, like the heap.
+ */
+static int as_map_region(struct addrspace *as, unsigned npages, unsigned rwx, unsigned type, segment_t **ret)
+{
+	segment_t *seg, **link;
+	unsigned k, total;
+	vaddr_t top, floor, start = 0;
+	int result;
+
+	if (npages == 0 || as->heap == NULL)
+		return EINVAL;
+	top = USERSTACK - stack_maxpages * PAGE_SIZE - STACK_GUARDPAGES * PAGE_SIZE;
+	if (as->stack->start - STACK_GUARDPAGES * PAGE_SIZE < top)
+		top = as->stack->start - STACK_GUARDPAGES * PAGE_SIZE;
+	for (k = as->nsegs - 1; k-- > 0; )
+	{ //downwards from the segment under the stack, stopping at the heap
+		seg = as->as_segidx[k];
+		floor = seg->start + seg->size;
+		if (seg == as->heap)
+			floor += STACK_GUARDPAGES * PAGE_SIZE;
+		if (top > floor && (top - floor) / PAGE_SIZE >= npages)
+		{
+			start = top - npages * PAGE_SIZE;
+			break;
+		}
+		if (seg == as->heap)
+			return ENOMEM;
+		if (seg->start < top)
+			top = seg->start;
+	}
+
+	seg = kmalloc(sizeof(segment_t));
+	if (seg == NULL)
+		return ENOMEM;
+	seg->start = start;
+	seg->size = 0;
+	seg->filesize = 0;
+	seg->npages = 0;
+	seg->rwx = rwx;
+	seg->type = type;
+	seg->offset = 0;
+	seg->initoffset = 0;
+	seg->vn = NULL;
+	seg->shm = NULL;
+	lock_acquire(as->pt_lock);
+	for (link = &as->as_segment; (*link)->start < start; link = &(*link)->next);
+	seg->next = *link;
+	*link = seg;
+	result = as_index_segments(as, &total);
+	lock_release(as->pt_lock);
+	if (result == 0)
+		result = as_grow_segment(as, seg, start, npages);
+	if (result)
+	{
+		as_unlink_segment(as, seg);
+		kfree(seg);
+		return result;
+	}
+	*ret = seg;
+	return 0;
+}
+
+//removes a segment made by as_map_region, writing back its dirty pages
+static void as_unmap_region(struct addrspace *as, segment_t *seg)
+{
+	as_shrink_segment(as, seg, seg->npages);
+	as_unlink_segment(as, seg);
+	kfree(seg);
+}
+
+//maps len bytes of vn from offset, see as_map_region
+int as_mmap(struct addrspace *as, struct vnode *vn, size_t len, off_t offset, unsigned rwx, vaddr_t *addr)
+{
+	segment_t *seg;
+
+	if (offset < 0 || offset % PAGE_SIZE != 0)
+		return EINVAL;
+	int result = as_map_region(as, DIVROUNDUP(len, PAGE_SIZE), rwx, SEG_MMAP, &seg);
+	if (result)
+		return result;
+	seg->vn = vn;
+	seg->offset = offset;
+	VOP_INCREF(vn);
+	*addr = seg->start;
+	return 0;
+}
+
+//removes a whole mapping made by as_mmap
+int as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	segment_t *seg = as_find_segment(as, addr);
+
+	if (seg == NULL || seg->type != SEG_MMAP || seg->start != addr || DIVROUNDUP(len, PAGE_SIZE) != seg->npages)
+		return EINVAL;
+	struct vnode *vn = seg->vn;
+	as_unmap_region(as, seg);
+	VOP_DECREF(vn);
+	return 0;
+}
+
+/*
+ * Access hints for the pages in [addr, addr + len), which must all belong to
+ * segments. NORMAL, SEQUENTIAL and RANDOM are stored in the page table
+ * entries, for the read-ahead window and the eviction order. WILLNEED faults
+ * the pages in right away, DONTNEED drops them with their swap slots, EINVAL
+ * if some of them are locked.
+ */
+int as_madvise(struct addrspace *as, vaddr_t addr, size_t len, int advice)
+{
+	vaddr_t va, end = addr + ROUNDUP(len, PAGE_SIZE);
+	segment_t *seg;
+
+	if (addr % PAGE_SIZE != 0 || end < addr)
+		return EINVAL;
+	if (advice < MADV_NORMAL || advice > MADV_DONTNEED)
+		return EINVAL;
+	for (va = addr; va < end; va += seg->start + seg->size - va)
+	{
+		seg = as_find_segment(as, va);
+		if (seg == NULL)
+			return ENOMEM;
+	}
+	if (advice == MADV_DONTNEED)
+	{ //dropping a locked page would unpin it, like munlock
+		lock_acquire(as->pt_lock);
+		for (va = addr; va < end && !as_lookup_pte(as, va)->locked; va += PAGE_SIZE);
+		lock_release(as->pt_lock);
+		if (va < end)
+			return EINVAL;
+	}
+
+	for (va = addr; va < end; va += PAGE_SIZE)
+	{
+		seg = as_find_segment(as, va);
+		if (advice == MADV_WILLNEED)
+		{ //faulted like the first access would, outside pt_lock
+			vm_fault(VM_FAULT_READ, va);
+			continue;
+		}
+		lock_acquire(as->pt_lock);
+		pt_entry *pte = &as->as_pt[seg->ptbase + (va - seg->start) / PAGE_SIZE];
+		switch (advice)
+		{
+		case MADV_NORMAL:
+			pte->advice = PT_ADV_NORMAL;
+			break;
+		case MADV_SEQUENTIAL:
+			pte->advice = PT_ADV_SEQUENTIAL;
+			break;
+		case MADV_RANDOM:
+			pte->advice = PT_ADV_RANDOM;
+			break;
+		case MADV_DONTNEED:
+			as_drop_page(as, pte);
+			break;
+		}
+		lock_release(as->pt_lock);
+	}
+	return 0;
+}
+
+//resident set of as grown or shrunk by npages, pt_lock must be held
+void as_rss_add(struct addrspace *as, int npages)
+{
+	as->ru.ru_rss += npages;
+	if (as->ru.ru_rss > as->ru.ru_maxrss)
+		as->ru.ru_maxrss = as->ru.ru_rss;
+}
+
+//counters of as, with the pages in swap counted now
+void as_getrusage(struct addrspace *as, struct vm_rusage *ru)
+{
+	lock_acquire(as->pt_lock);
+	*ru = as->ru;
+	ru->ru_swapped = 0;
+	for (unsigned i = 0; i < as->npages; i++)
+	{
+		if (as->as_pt[i].in_swap)
+			ru->ru_swapped++;
+	}
+	lock_release(as->pt_lock);
+}
+
+void as_print_rusage(struct addrspace *as, const char *name)
+{
+	struct vm_rusage ru;
+
+	as_getrusage(as, &ru);
+	kprintf("%s: rss %u, peak %u, swapped %u, faults %u (reloads %u, zero %u, elf %u, swap in %u), swap out %u\n",
+		name, ru.ru_rss, ru.ru_maxrss, ru.ru_swapped, ru.ru_tlbfaults, ru.ru_reloads,
+		ru.ru_zerofills, ru.ru_elfreads, ru.ru_swapins, ru.ru_swapouts);
+}
+
+int as_set_mlockmax(unsigned npages)
+{
+	if (npages > getRamPages() / 2)
+		return EINVAL;
+	mlock_maxpages = npages;
+	return 0;
+}
+
+//page table entry of va, NULL if it is in no segment. pt_lock must be held
+pt_entry *as_lookup_pte(struct addrspace *as, vaddr_t va)
+{
+	segment_t *seg = as_find_segment(as, va);
+	if (seg == NULL)
+		return NULL;
+	return &as->as_pt[seg->ptbase + (va - seg->start) / PAGE_SIZE];
+}
+
+//counts the pages of [addr, end) not locked yet, ENOMEM if some are outside the segments
+static int as_count_unlocked(struct addrspace *as, vaddr_t addr, vaddr_t end, unsigned *n)
+{
+	*n = 0;
+	if (addr % PAGE_SIZE != 0 || end < addr)
+		return EINVAL;
+	lock_acquire(as->pt_lock);
+	for (vaddr_t va = addr; va < end; va += PAGE_SIZE)
+	{
+		if (as_find_segment(as, va) == NULL)
+		{
+			lock_release(as->pt_lock);
+			return ENOMEM;
+		}
+		if (!as_lookup_pte(as, va)->locked)
+			(*n)++;
+	}
+	lock_release(as->pt_lock);
+	return 0;
+}
+
+//private page that mlock faults in for writing
+static bool as_mlock_writable(pt_entry *pte)
+{
+	return (pte->rwx & 2) && !pte->mapped;
+}
+
+/*
+ * Faults in the pages of [addr, addr + len) and pins their frames, up to
+ * mlock_maxpages per process. Writable private pages are faulted for
+ * writing, so that no copy-on-write (or zero frame) is left on a locked page.
+ */
+int as_mlock(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	vaddr_t va, end = addr + ROUNDUP(len, PAGE_SIZE);
+	unsigned n;
+
+	int result = as_count_unlocked(as, addr, end, &n);
+	if (result)
+		return result;
+	if (as->nlocked + n > mlock_maxpages)
+		return ENOMEM;
+
+	for (va = addr; va < end; va += PAGE_SIZE)
+	{
+		lock_acquire(as->pt_lock);
+		pt_entry *pte = as_lookup_pte(as, va);
+		while (pte != NULL && (!pte->in_mem || (as_mlock_writable(pte) && (pte->cow || pte->zero))))
+		{ //read-only pages may keep sharing a page cache frame, which is not evicted while mapped
+			int type = as_mlock_writable(pte) ? VM_FAULT_WRITE : VM_FAULT_READ;
+			lock_release(as->pt_lock);
+			result = vm_fault(type, va);
+			if (result)
+				return result;
+			lock_acquire(as->pt_lock);
+			pte = as_lookup_pte(as, va);
+		}
+		if (pte == NULL)
+		{ //unmapped meanwhile
+			lock_release(as->pt_lock);
+			return ENOMEM;
+		}
+		if (!pte->locked)
+		{
+			pte->locked = 1;
+			as->nlocked++;
+			pinPage(pte->paddr, as);
+			vm_stats_inc(PAGES_LOCKED);
+		}
+		lock_release(as->pt_lock);
+	}
+	return 0;
+}
+
+int as_munlock(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	vaddr_t va, end = addr + ROUNDUP(len, PAGE_SIZE);
+	unsigned n;
+
+	int result = as_count_unlocked(as, addr, end, &n);
+	if (result)
+		return result;
+	lock_acquire(as->pt_lock);
+	for (va = addr; va < end; va += PAGE_SIZE)
+	{
+		pt_entry *pte = as_lookup_pte(as, va);
+		if (pte != NULL && pte->locked)
+		{
+			pte->locked = 0;
+			as->nlocked--;
+			unpinPage(pte->paddr, as);
+			vm_stats_inc(PAGES_UNLOCKED);
+		}
+	}
+	lock_release(as->pt_lock);
+	return 0;
+}
+
+#if OPT_SHM
+//attaches the shared memory object id, see as_map_region
+int as_shmat(struct addrspace *as, int id, vaddr_t *addr)
+{
+	segment_t *seg;
+	unsigned npages;
+
+	int result = shm_size(id, &npages);
+	if (result)
+		return result;
+	result = as_map_region(as, npages, PF_R | PF_W, SEG_SHM, &seg);
+	if (result)
+		return result;
+	result = shm_attach(id, npages, as, seg->start, &seg->shm);
+	if (result)
+	{
+		as_unmap_region(as, seg);
+		return result;
+	}
+	*addr = seg->start;
+	return 0;
+}
+
+int as_shmdt(struct addrspace *as, vaddr_t addr)
+{
+	segment_t *seg = as_find_segment(as, addr);
+
+	if (seg == NULL || seg->type != SEG_SHM || seg->start != addr)
+		return EINVAL;
+	shm_detach(seg->shm, as); //first, so that reclaim stops looking at our entries
+	as_unmap_region(as, seg);
+	return 0;
+}
+
+/*
+ * Adds to refs the reference the entry of as for the page at vaddr holds,
+ * if it maps the frame. False if the entry is locked: the page stays.
+ */
+bool as_shm_mapping(struct addrspace *as, vaddr_t vaddr, unsigned *refs)
+{
+	bool movable = true;
+
+	lock_acquire(as->pt_lock);
+	segment_t *seg = as_find_segment(as, vaddr);
+	if (seg != NULL && seg->type == SEG_SHM)
+	{
+		pt_entry *pte = &as->as_pt[seg->ptbase + (vaddr - seg->start) / PAGE_SIZE];
+		if (pte->in_mem)
+			(*refs)++;
+		movable = !pte->locked;
+	}
+	lock_release(as->pt_lock);
+	return movable;
+}
+
+/*
+ * Shared memory reclaim is taking the frame of the page at vaddr, which an
+ * attached address space may map: the entry goes back to faulting.
+ */
+void as_shm_drop(struct addrspace *as, vaddr_t vaddr)
+{
+	lock_acquire(as->pt_lock);
+	segment_t *seg = as_find_segment(as, vaddr);
+	if (seg != NULL && seg->type == SEG_SHM)
+	{
+		pt_entry *pte = &as->as_pt[seg->ptbase + (vaddr - seg->start) / PAGE_SIZE];
+		if (pte->in_mem && !pte->locked)
+		{ //a locked entry keeps its reference, reclaim then leaves the page alone
+			tlb_shootdown(as, vaddr);
+			putSharedPage(pte->paddr);
+			pte->in_mem = 0;
+			pte->paddr = 0;
+			as_rss_add(as, -1);
+		}
+	}
+	lock_release(as->pt_lock);
+}
+#endif
+
 /*
  *    as_complete_load - this is called when loading from an executable  
  *                is complete.
@@ -387,11 +1347,28 @@ static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 void vm_bootstrap(void)
 {
 	vm_stats_init(); //initializes the counters for the stats to be printed when the vm is shut down
+	tlb_shootdown_init();
 	swapmap_init();  //initializes the array for the swapmap, its dimension depends on SWAP_SIZE
 	coremap_init();  /*initializes the array for the coremap, its size depends on the RAM
 					   size(address of the last free physical page) and the address of the
 					   first free physical page; the difference between these two is then
 					   divided by PAGE_SIZE to get the number of entries in the coremap*/
+	zero_frame = reservePages(1);
+	if (zero_frame == 0)
+		panic("Could not reserve the zero frame\n");
+	bzero((void *)PADDR_TO_KVADDR(zero_frame), PAGE_SIZE);
+#if OPT_ZSWAP
+	zswap_init();    //reserves the frames of the compressed swap pool, needs the coremap
+#endif
+#if OPT_PAGECACHE
+	pagecache_init();
+#endif
+#if OPT_SHM
+	shm_init();
+#endif
+#if OPT_KSM
+	ksm_init();
+#endif
 }
 
 static paddr_t
@@ -429,21 +1406,230 @@ void free_kpages(vaddr_t addr)
 {
 	if (isCoremapActive())
 	{
-		paddr_t paddr;
-		int result = getPageVtoP(addr, &paddr);
-		if(result > 0) {
-			freepages(paddr);
-		} else if(result == 0)  {
-			paddr_t paddr = addr - MIPS_KSEG0;
-			freepages(paddr);
-		} else {
-			panic("vaddr 0x%x not found in the page table\n", addr);
-		} 
+		//kernel pages are direct-mapped, whatever process is running
+		KASSERT(addr >= MIPS_KSEG0);
+		freepages(addr - MIPS_KSEG0);
 	}
 }
 
-/* Fault handling function called by trap code */
-int vm_fault(int faulttype, vaddr_t faultaddress)
+/*
+ * Terminates the current process if the OOM killer chose it. Called on
+ * user faults and at the end of each syscall, where no locks are held.
+ */
+void as_oom_exit(void)
+{
+	struct addrspace *as = proc_getas();
+	if (as == NULL || !as->oom_killed)
+		return;
+	kprintf("Out of memory: killed process %s\n", curproc->p_name);
+	sys__exit(_MKWAIT_SIG(SIGKILL));
+}
+
+//a page could not be found for the faulting process
+static int vm_oom(struct addrspace *as)
+{
+	if (!as->oom_killed)
+		return ENOMEM;
+	if (curthread->t_machdep.tm_badfaultfunc != NULL)
+		return EFAULT; //inside copyin/copyout: the syscall fails and the process exits on its way out
+	as_oom_exit();
+	return ENOMEM;
+}
+
+//read-ahead window for a fault on pte, following its madvise hint
+static unsigned vm_readahead(pt_entry *pte)
+{
+	switch (pte->advice)
+	{
+	case PT_ADV_SEQUENTIAL:
+		return ELF_MAXREADAHEAD;
+	case PT_ADV_RANDOM:
+		return 0;
+	default:
+		return elf_readahead;
+	}
+}
+
+#if OPT_PAGECACHE
+/*
+ * Maps a read-only page of the binary to the frame the page cache keeps for
+ * it, so that all the processes running the binary share one copy.
+ * Called and returns with pt_lock held, which is dropped meanwhile.
+ */
+static int vm_map_cached(struct addrspace *as, segment_t *seg, pt_entry *pte)
+{
+	paddr_t paddr;
+	lock_release(as->pt_lock);
+	int result = pagecache_get(as, seg, pte->vaddr, vm_readahead(pte), &paddr);
+	lock_acquire(as->pt_lock);
+	if (result == 0)
+		pte->paddr = paddr;
+	return result;
+}
+
+/*
+ * Same for a page of a shared file mapping, mapped by all the processes
+ * mapping the file so that they see each other's writes.
+ */
+static int vm_map_file(struct addrspace *as, segment_t *seg, pt_entry *pte)
+{
+	paddr_t paddr;
+	lock_release(as->pt_lock);
+	int result = pagecache_get_file(as, seg, pte->vaddr, &paddr);
+	lock_acquire(as->pt_lock);
+	if (result == 0)
+		pte->paddr = paddr;
+	return result;
+}
+#endif
+
+/*
+ * Loads pt[i] from the ELF with a single read, together with up to
+ * vm_readahead following pages of the segment (ending at pt[segend]) never
+ * loaded before. Those become resident right away, in frames that are free
+ * at the moment: read-ahead never evicts. Called with pt_lock held.
+ */
+static int vm_load_elf(struct addrspace *as, segment_t *seg, unsigned segend, unsigned i)
+{
+	pt_entry *pt = as->as_pt;
+	paddr_t paddrs[ELF_MAXREADAHEAD + 1];
+	unsigned first = i, n = 0, max, k;
+	int result;
+
+	if (elf_cluster_pages(seg, pt[i].vaddr, 1) == 0)
+	{ //the first page of a segment has its own layout, the window starts after it
+		result = load_elf_ondemand(seg, pt[i].paddr, pt[i].vaddr);
+		if (result || ++first == segend)
+			return result;
+	}
+	max = elf_cluster_pages(seg, pt[first].vaddr, vm_readahead(&pt[i]) + (first == i));
+	for (k = first; k < first + max && k < segend; k++)
+	{
+		if (k == i)
+		{
+			paddrs[n++] = pt[i].paddr;
+			continue;
+		}
+		if (pt[k].in_mem || pt[k].in_swap || pt[k].zero_fill || pt[k].paddr != 0)
+			break; //loaded before, the window must stay contiguous
+		paddr_t paddr = getPages(1, pt[k].vaddr, NULL); //free frames only
+		if (paddr == 0)
+			break;
+		setPageOwner(paddr, as);
+		paddrs[n++] = paddr;
+	}
+	if (n == 0)
+		return 0;
+
+	result = load_elf_cluster(seg, paddrs, pt[first].vaddr, n);
+	for (k = 0; k < n; k++)
+	{
+		pt_entry *pte = &pt[first + k];
+		if (first + k == i)
+			continue;
+		if (result)
+		{
+			freepages(paddrs[k]);
+			continue;
+		}
+		pte->paddr = paddrs[k];
+		pte->in_mem = 1;
+		pte->readahead = 1;
+		as_rss_add(as, 1);
+	}
+	if (result == 0)
+		vm_stats_add(ELF_READAHEAD, n - (first == i));
+	return result;
+}
+
+/*
+ * First write to a copy-on-write page: the last address space mapping the
+ * frame takes it back, the others get a private copy. Called with pt_lock
+ * held, which is released if an error is returned.
+ */
+static int vm_cow_break(struct addrspace *as, pt_entry *pte)
+{
+	paddr_t old_paddr = pte->paddr;
+	int result;
+
+	if (!claimSharedPage(old_paddr, as))
+	{
+		lock_release(as->pt_lock);
+		paddr_t new_paddr = getPages(1, pte->vaddr, as);
+		if (new_paddr == 0)
+			return vm_oom(as);
+		lock_acquire(as->pt_lock);
+		if (pte->in_swap)
+		{ //evictShared moved it to swap meanwhile, the new frame is filled from there
+			result = swap_in(&pte->paddr, new_paddr, true);
+			if (result)
+			{
+				lock_release(as->pt_lock);
+				freepages(new_paddr);
+				return result;
+			}
+			pte->in_swap = 0;
+			vm_stats_inc(SWAP_READ);
+			vm_stats_inc(PAGE_FAULT_DISK);
+			as->ru.ru_swapins++;
+		}
+		else if (pte->zero_fill)
+		{ //or dropped it, being all zero
+			bzero((void *)PADDR_TO_KVADDR(new_paddr), PAGE_SIZE);
+			pte->paddr = new_paddr;
+			pte->zero_fill = 0;
+			vm_stats_inc(PAGE_FAULT_ZEROED);
+			as->ru.ru_zerofills++;
+		}
+		if (!pte->in_mem)
+		{ //a private page again, no copy to make
+			pte->in_mem = 1;
+			as_rss_add(as, 1);
+			tlb_invalidate_vaddr(pte->vaddr);
+			return 0;
+		}
+		//our reference keeps the old frame alive while copying, pt_lock keeps it mapped
+		memmove((void *)PADDR_TO_KVADDR(new_paddr), (const void *)PADDR_TO_KVADDR(old_paddr), PAGE_SIZE);
+		putSharedPage(old_paddr);
+		pte->paddr = new_paddr;
+	}
+	pte->cow = 0;
+	tlb_invalidate_vaddr(pte->vaddr); //drop the read-only entry before loading the writable one
+	vm_stats_inc(COW_FAULT);
+	return 0;
+}
+
+//the page was never written, or was all zero when evicted: it reads as the zero frame
+static bool vm_zero_page(segment_t *seg, pt_entry *pte)
+{
+	if (pte->zero_fill || seg->type == SEG_HEAP || seg->type == SEG_STACK)
+		return true;
+	size_t amt = pte->vaddr - seg->start;
+	return seg->type == SEG_ELF && amt != 0 && amt >= seg->filesize; //bss, past the file data
+}
+
+/*
+ * First write to a page mapping the zero frame: it gets a zeroed frame of
+ * its own. Called with pt_lock held, which is released if an error is returned.
+ */
+static int vm_zero_break(struct addrspace *as, pt_entry *pte)
+{
+	lock_release(as->pt_lock);
+	paddr_t paddr = getPages(1, pte->vaddr, as);
+	if (paddr == 0)
+		return vm_oom(as);
+	bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+	lock_acquire(as->pt_lock);
+	pte->paddr = paddr;
+	pte->zero = 0;
+	tlb_invalidate_vaddr(pte->vaddr); //drop the read-only entry before loading the writable one
+	vm_stats_inc(PAGE_FAULT_ZEROED);
+	as->ru.ru_zerofills++;
+	as_rss_add(as, 1);
+	return 0;
+}
+
+static int vm_handle_fault(int faulttype, vaddr_t faultaddress)
 {
 	struct addrspace *as;
 	vm_stats_inc(TLB_FAULT);
@@ -472,44 +1658,53 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 		 */
 		return EFAULT;
 	}
+	if (as->oom_killed)
+		return vm_oom(as);
+	as->ru.ru_tlbfaults++;
 
 	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
 	int result;
 	
 	
-	segment_t *seg = as->as_segment;
-	unsigned np = 0;
-
-	//Search for the first vaddress of the segment of interest
-	while (seg->next != NULL)
-	{
-		if (faultaddress < seg->next->start)
-			break;
-		np += seg->npages;
-		seg = seg->next;
+	segment_t *seg = as_find_segment(as, faultaddress);
+	if (seg == NULL)
+	{ //not part of the address space, unless the stack grows to include it
+		result = as_grow_stack(as, faultaddress);
+		if (result)
+			return result;
+		seg = as->stack;
 	}
+	unsigned np = seg->ptbase;
 
-	//Search for the actual page in the page table
-	unsigned i;
+	//the page table follows the segments, one entry per page
+	unsigned i = np + (faultaddress - seg->start) / PAGE_SIZE;
 	lock_acquire(as->pt_lock);
 	pt_entry *pt = as->as_pt;
-	for(i = np; i < (np + seg->npages); i++) {
-		if(pt[i].vaddr == faultaddress){
-			break;}
-	}
-	if (i == np + seg->npages)
-	{
-		lock_release(as->pt_lock);
-		panic("pt with addr 0x%x not initialized!\n", faultaddress);
-		return 0;
-	}
+	KASSERT(pt[i].vaddr == faultaddress);
 	switch (faulttype)
 	{
 	case VM_FAULT_READONLY:
 	{
-		/* We always create pages read-write, so we can't get this */
-		lock_release(as->pt_lock);
-		panic("vm: got VM_FAULT_READONLY at address 0x%x\n", faultaddress); //signal process to terminate.
+		if (pt[i].in_mem && pt[i].mapped && (pt[i].rwx & 2))
+		{ //first write to a shared mapping page, from now on it is written back
+			tlb_invalidate_vaddr(faultaddress);
+			break;
+		}
+		if (pt[i].in_mem && pt[i].zero && (pt[i].rwx & 2))
+		{
+			result = vm_zero_break(as, &pt[i]);
+			if (result)
+				return result;
+			break;
+		}
+		if (!pt[i].in_mem || !pt[i].cow || !(pt[i].rwx & 2))
+		{ //write to a read-only segment
+			lock_release(as->pt_lock);
+			return EFAULT;
+		}
+		result = vm_cow_break(as, &pt[i]);
+		if (result)
+			return result;
 	}
 	break;
 	case VM_FAULT_READ:
@@ -517,35 +1712,107 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 	{
 		if (pt[i].in_mem == 0)
 		{
+#if OPT_VMPROFILE
+			if (!pt[i].in_swap)
+				vmprofile_record(as, faultaddress);
+#endif
 			if (pt[i].in_swap) //if the page is in the swapfile, get it from there
 			{
 				lock_release(as->pt_lock);
 				paddr_t new_paddr = getPages(1,faultaddress,as);
+				if (new_paddr == 0)
+					return vm_oom(as);
 				lock_acquire(as->pt_lock);
 				result = swap_in(&(pt[i].paddr), new_paddr, true);
 				pt[i].in_swap = 0; //update the page information in the page table
 				vm_stats_inc(SWAP_READ);
 				vm_stats_inc(PAGE_FAULT_DISK);
+				as->ru.ru_swapins++;
+			}
+#if OPT_SHM
+			else if (pt[i].shm)
+			{ //the object knows where the page is, in RAM, in swap or nowhere yet
+				paddr_t paddr;
+				lock_release(as->pt_lock);
+				result = shm_getpage(seg->shm, (faultaddress - seg->start) / PAGE_SIZE, faultaddress, as, &paddr);
+				if (result)
+					return result == ENOMEM ? vm_oom(as) : result;
+				lock_acquire(as->pt_lock);
+				pt[i].paddr = paddr;
+			}
+#endif
+#if OPT_PAGECACHE
+			else if (seg->type == SEG_ELF && !(pt[i].rwx & 2) && vm_map_cached(as, seg, &pt[i]) == 0)
+			{
+				pt[i].shared = 1; //otherwise fall back to a private copy
+			}
+			else if (seg->type == SEG_MMAP && (result = vm_map_file(as, seg, &pt[i])) != ENOSPC)
+			{ //a private frame only when the cache has no entry left
+				if (result)
+				{
+					lock_release(as->pt_lock);
+					return result == ENOMEM ? vm_oom(as) : result;
+				}
+				pt[i].shared = 1;
+			}
+#endif
+			else if (faulttype == VM_FAULT_READ && pt[i].paddr == 0 && vm_zero_page(seg, &pt[i]))
+			{ //only read so far, no frame until the first write
+				pt[i].paddr = zero_frame;
+				pt[i].zero = 1;
+				pt[i].zero_fill = 0;
+				vm_stats_inc(ZERO_PAGE_MAP);
 			}
 			else
 			{ //page is not in swap, load it from the ELF on-demand
 				if (pt[i].paddr == 0) {
 					lock_release(as->pt_lock);
 					pt[i].paddr = getPages(1,faultaddress,as);
+					if (pt[i].paddr == 0)
+						return vm_oom(as);
 					lock_acquire(as->pt_lock);
-				} if (seg->next != NULL){
-					result = load_elf_ondemand(seg, pt[i].paddr, faultaddress);
+				} if (seg->type == SEG_MMAP) {
+					result = vm_mmap_io(seg, pt[i].paddr, faultaddress, UIO_READ);
+					if (result) {
+						freepages(pt[i].paddr);
+						pt[i].paddr = 0;
+						lock_release(as->pt_lock);
+						return result;
+					}
+					vm_stats_inc(PAGE_FAULT_DISK);
+				} else if (seg->type == SEG_ELF && !vm_zero_page(seg, &pt[i])){ //bss written first is zeroed below
+					result = vm_load_elf(as, seg, np + seg->npages, i);
 					vm_stats_inc(ELF_READ);
 					vm_stats_inc(PAGE_FAULT_DISK);
-				} else { //the required page is in kernel
+					as->ru.ru_elfreads++;
+				} else { //the required page is in kernel, or it was all zero when evicted
 					bzero((void*)PADDR_TO_KVADDR(pt[i].paddr),PAGE_SIZE);
 					vm_stats_inc(PAGE_FAULT_ZEROED);
+					as->ru.ru_zerofills++;
 				}
+				pt[i].zero_fill = 0;
 			}
 			pt[i].in_mem = 1; //update page's information
+			if (!pt[i].zero)
+				as_rss_add(as, 1);
+		}
+		else if (faulttype == VM_FAULT_WRITE && pt[i].cow) {
+			result = vm_cow_break(as, &pt[i]);
+			if (result)
+				return result;
+		}
+		else if (faulttype == VM_FAULT_WRITE && pt[i].zero && (pt[i].rwx & 2)) {
+			result = vm_zero_break(as, &pt[i]);
+			if (result)
+				return result;
 		}
 		else {
 			vm_stats_inc(TLB_RELOAD);
+			as->ru.ru_reloads++;
+			if (pt[i].readahead) {
+				vm_stats_inc(ELF_READAHEAD_HIT);
+				pt[i].readahead = 0;
+			}
 		}
 	}
 	break;
@@ -553,11 +1820,28 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 		lock_release(as->pt_lock);
 		return EINVAL;
 	}
-	result = tlb_loadentry(faultaddress, pt[i].paddr, !(pt[i].rwx & 2)); //load the new page in the TLB
+	if (faulttype != VM_FAULT_READ && pt[i].mapped)
+		pt[i].dirty = 1;
+	//clean mapped pages stay read-only to catch the first write
+	result = tlb_loadentry(faultaddress, pt[i].paddr, !(pt[i].rwx & 2) || pt[i].cow || pt[i].zero || (pt[i].mapped && !pt[i].dirty)); //load the new page in the TLB
 	lock_release(as->pt_lock);
 	return result;
 }
 
+/* Fault handling function called by trap code, timed as a reload or a page fault */
+int vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as = proc_getas();
+	unsigned reloads = as != NULL ? as->ru.ru_reloads : 0;
+	uint64_t start = vm_lat_now();
+
+	int result = vm_handle_fault(faulttype, faultaddress);
+	bool reload = as != NULL && as->ru.ru_reloads != reloads;
+	vm_lat_record(reload ? LAT_RELOAD : LAT_FAULT, start);
+	VMTRACE(VMTR_FAULT, faultaddress, faulttype | reload << 4 | result << 8);
+	return result;
+}
+
 int checkcanLock() {
   if (CURCPU_EXISTS())
 	{
@@ -10,7 +10,16 @@
 #include <swapfile.h>
 #include <vmstats.h>
 #include <vm_tlb.h>
+#include <vmtrace.h>
 #include <synch.h>
+#include "opt-pagecache.h"
+#if OPT_PAGECACHE
+#include <pagecache.h>
+#endif
+#include "opt-shm.h"
+#if OPT_SHM
+#include <shm.h>
+#endif
 
 static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
 
@@ -19,6 +28,7 @@ unsigned int ram_used = 0;
 static paddr_t firstpaddr; /* address of first free physical page */
 static paddr_t lastpaddr;  /* one past end of last free physical page */
 static int coremapActive = 0;
+static struct lock *reclaim_lock; //one reclaim looking at other address spaces at a time, see reclaimWait
 
 static int swapvictim()
 {
@@ -29,6 +39,17 @@ static int swapvictim()
 	return svic;
 }
 
+//word-wise scan of a frame, stops at the first non-zero word
+static bool page_is_zero(paddr_t paddr)
+{
+    const uint32_t *w = (const uint32_t *)PADDR_TO_KVADDR(paddr);
+    for (unsigned k = 0; k < PAGE_SIZE / sizeof(uint32_t); k++) {
+        if (w[k] != 0)
+            return false;
+    }
+    return true;
+}
+
 static int _isCoremapActive()
 {
     return coremapActive;
@@ -58,6 +79,10 @@ void coremap_init(void)
     bzero(coremap, sizeof(c_entry) * coremapSize);
     firstpaddr += csize * PAGE_SIZE; //this represents the first free entry of the ram
 
+    reclaim_lock = lock_create("RECLAIM_lock");
+    if (reclaim_lock == NULL)
+        panic("Reclaim lock was not created succesfully\n");
+
     spinlock_acquire(&coremap_lock);
     coremapActive = 1;
     spinlock_release(&coremap_lock);
@@ -73,6 +98,7 @@ static void set_empty(int i)
 {
     coremap[i].vaddr = 0;
     coremap[i].as = NULL;
+    coremap[i].refcount = 0;
 }
 
 
@@ -89,10 +115,388 @@ void freeAs(struct addrspace *as)
     spinlock_release(&coremap_lock);
 }
 
+/*
+ * Takes the frame away from a resident page of as, swapping it out if it is
+ * writable. Returns ENOMEM, leaving the page where it is, if it could not be
+ * saved. pt_lock must be held.
+ */
+static int evictEntry(struct addrspace *as, pt_entry *pte)
+{
+    paddr_t frame = pte->paddr;
+    bool written = false;
+
+    if(pte->mapped) { // file mapping, goes back to its file instead of the swap
+        if(pte->dirty && as_mmap_writeback(as, pte) != 0)
+            return ENOMEM;
+        written = pte->dirty;
+        pte->dirty = 0;
+        pte->paddr = 0;
+    } else if(pte->rwx & 2) { // if page is not readonly, swap it out
+        if(page_is_zero(pte->paddr)) { // nothing to save, no slot and no I/O
+            pte->zero_fill = 1;
+            pte->paddr = 0;
+            vm_stats_inc(SWAP_ZERO_SKIP);
+        } else if (swap_out(&pte->paddr) == 0) {
+            vm_stats_inc(SWAP_WRITE);
+            as->ru.ru_swapouts++;
+            pte->in_swap = 1;
+            written = true;
+        } else //swap filled up meanwhile
+            return ENOMEM;
+    } else pte->paddr = 0; //just erase the entry, it will be read again from the ELF if needed
+    pte->in_mem = 0; //update its info in the page table
+    as_rss_add(as, -1);
+    pte->readahead = 0;
+    tlb_shootdown(as, pte->vaddr); //invalidate the entry in the TLB, as may be another process
+    VMTRACE(VMTR_EVICT, frame, written);
+    return 0;
+}
+
+static bool ownsFrame(struct addrspace *as, unsigned i)
+{
+    spinlock_acquire(&coremap_lock);
+    bool owned = !(coremap[i].vaddr & 0x1) && coremap[i].as == as;
+    spinlock_release(&coremap_lock);
+    return owned;
+}
+
+/*
+ * A page of a range advised sequential that the scan (now faulting at
+ * vaddr) has left behind: the furthest one is the first to go.
+ */
+static int evictBehind(struct addrspace *as, vaddr_t vaddr, unsigned *victim)
+{
+    pt_entry *pt, *behind = NULL;
+
+    lock_acquire(as->pt_lock);
+    pt = as->as_pt;
+    for (unsigned j = 0; j < as->npages; j++)
+    {
+        if (pt[j].in_mem && pt[j].advice == PT_ADV_SEQUENTIAL && pt[j].vaddr < vaddr &&
+            (behind == NULL || pt[j].vaddr < behind->vaddr) &&
+            ownsFrame(as, (pt[j].paddr - firstpaddr) / PAGE_SIZE))
+            behind = &pt[j];
+    }
+    if (behind != NULL)
+    {
+        unsigned i = (behind->paddr - firstpaddr) / PAGE_SIZE;
+        if (evictEntry(as, behind) == 0)
+        {
+            vm_stats_inc(DROP_BEHIND);
+            lock_release(as->pt_lock);
+            *victim = i;
+            return 0;
+        }
+    }
+    lock_release(as->pt_lock);
+    return ENOMEM;
+}
+
+/*
+ * Evicts a frame for the page of as at vaddr. Pages left behind by a
+ * sequential scan of as go first, then the round-robin victim, whichever
+ * address space owns it: a frame of another one is handed to as while its
+ * pt_lock is still held, so that its freeAs leaves the frame alone.
+ * Frames whose page table entry is not set yet (the fault is still being
+ * served) are skipped. Returns ENOMEM if nothing could be evicted.
+ */
+static int evictPage(struct addrspace *as, vaddr_t vaddr, unsigned *victim)
+{
+    struct addrspace *owner;
+    pt_entry *pt;
+    unsigned i, n;
+    int result;
+
+    if (evictBehind(as, vaddr, victim) == 0)
+        return 0;
+    lock_acquire(reclaim_lock); //the owners found in the coremap are not destroyed meanwhile
+    for (n = 0; n < 2 * coremapSize; n++)
+    {
+        spinlock_acquire(&coremap_lock);
+        i = swapvictim();
+        owner = CUSED(i) && !CRES(i) ? coremap[i].as : NULL;
+        spinlock_release(&coremap_lock);
+        if (owner == NULL) //free, reserved or shared
+            continue;
+
+        result = EAGAIN;
+        lock_acquire(owner->pt_lock);
+        pt = owner->as_pt; //sbrk may have moved the table
+        for (unsigned j = 0; j < owner->npages; j++)
+        {
+            if (pt[j].in_mem && pt[j].paddr == i * PAGE_SIZE + firstpaddr)
+            {
+                if (ownsFrame(owner, i)) //not released and reused meanwhile
+                    result = evictEntry(owner, &pt[j]);
+                break;
+            }
+        }
+        if (result == 0)
+        {
+            spinlock_acquire(&coremap_lock);
+            coremap[i].as = as;
+            spinlock_release(&coremap_lock);
+        }
+        lock_release(owner->pt_lock);
+        if (result == EAGAIN)
+            continue;
+        lock_release(reclaim_lock);
+        if (result == 0)
+            *victim = i; //swaps out first page found
+        return result;
+    }
+    lock_release(reclaim_lock);
+    return ENOMEM;
+}
+
+/*
+ * Takes frame i away from owner, a process marked by the OOM killer, if a
+ * page table entry of owner maps it: as in evictPage, a frame that owner is
+ * still filling inside vm_fault is skipped. The contents are dropped and the
+ * entry cleared, so owner neither maps the frame again nor releases it on
+ * its way out; a CPU still running owner drops it from its TLB before the
+ * frame is returned. reclaim_lock must be held.
+ */
+static bool oomTake(struct addrspace *owner, unsigned i, struct addrspace *as)
+{
+    pt_entry *pt;
+    bool taken = false;
+
+    lock_acquire(owner->pt_lock);
+    pt = owner->as_pt;
+    for (unsigned j = 0; j < owner->npages; j++)
+    {
+        if (!pt[j].in_mem || pt[j].paddr != i * PAGE_SIZE + firstpaddr)
+            continue;
+        spinlock_acquire(&coremap_lock);
+        if (!CRES(i) && coremap[i].as == owner)
+        {
+            coremap[i].as = as; //no longer freed by the victim's freeAs
+            taken = true;
+        }
+        spinlock_release(&coremap_lock);
+        if (taken)
+        {
+            pt[j].in_mem = 0;
+            pt[j].paddr = 0;
+            pt[j].dirty = 0;
+            pt[j].readahead = 0;
+            as_rss_add(owner, -1);
+            tlb_shootdown(owner, pt[j].vaddr);
+        }
+        break;
+    }
+    lock_release(owner->pt_lock);
+    return taken;
+}
+
+/*
+ * Out of RAM and swap: instead of panicking, take a frame from a process
+ * chosen by the OOM killer. It is marked and exits at its next fault or
+ * syscall without touching the frame again.
+ * If the victim is as itself there is nothing to take: the caller gets ENOMEM.
+ */
+static int oomReclaim(struct addrspace *as, unsigned *frame)
+{
+    unsigned i, start = 0;
+    bool retry = true;
+    struct addrspace *owner;
+
+    lock_acquire(reclaim_lock);
+    while (true) {
+        owner = NULL;
+        spinlock_acquire(&coremap_lock);
+        for (i = start; i < coremapSize; i++) {
+            // the owner of a frame stays valid until freeAs, which takes this lock,
+            // and as_destroy waits for reclaim_lock after it
+            if (!CRES(i) && coremap[i].as != NULL && coremap[i].as != as && coremap[i].as->oom_killed) {
+                owner = coremap[i].as;
+                break;
+            }
+        }
+        spinlock_release(&coremap_lock);
+        if (owner != NULL) {
+            if (oomTake(owner, i, as))
+                break;
+            start = i + 1; //still being filled, or released meanwhile
+            continue;
+        }
+        if (!retry)
+            break;
+        //nothing left to take from dead processes, pick a new one
+        struct addrspace *victim = proc_oom_victim();
+        if (victim == NULL || victim == as)
+            break;
+        retry = false;
+        start = 0;
+    }
+    lock_release(reclaim_lock);
+    if (owner == NULL)
+        return ENOMEM;
+    vm_stats_inc(OOM_RECLAIM);
+    *frame = i;
+    return 0;
+}
+
+/*
+ * Moves every copy-on-write mapping of frame i to a single swap slot, or to
+ * zero_fill if the page is all zero. The reference taken by the caller keeps
+ * the frame while the page tables are walked: true if it is the last one
+ * left, the frame is then free to be reused. Mappings not found, of a fork
+ * still in as_copy, keep the frame. reclaim_lock must be held, so that the
+ * address spaces found in the process table are not destroyed meanwhile.
+ */
+static bool evictSharedFrame(unsigned i)
+{
+    paddr_t frame = i * PAGE_SIZE + firstpaddr, slot = frame;
+    bool zero = page_is_zero(frame), slot_used = false, freed = false;
+    struct addrspace *owner;
+    int pid = 0;
+
+    if (!zero && swap_out(&slot) != 0)
+        return false;
+    while ((owner = proc_next_as(&pid)) != NULL)
+    {
+        lock_acquire(owner->pt_lock);
+        pt_entry *pt = owner->as_pt;
+        for (unsigned j = 0; j < owner->npages; j++)
+        {
+            if (!pt[j].in_mem || !pt[j].cow || pt[j].paddr != frame)
+                continue;
+            if (zero) {
+                pt[j].zero_fill = 1;
+                pt[j].paddr = 0;
+            } else {
+                if (slot_used)
+                    swap_dup(slot);
+                slot_used = true;
+                pt[j].in_swap = 1;
+                pt[j].paddr = slot;
+            }
+            pt[j].in_mem = 0;
+            pt[j].cow = 0;
+            pt[j].readahead = 0;
+            as_rss_add(owner, -1);
+            tlb_shootdown(owner, pt[j].vaddr);
+            putSharedPage(frame); //never the last reference, the caller holds one
+        }
+        lock_release(owner->pt_lock);
+    }
+    if (!zero && !slot_used)
+        clear_swap(slot);
+    else
+        vm_stats_inc(zero ? SWAP_ZERO_SKIP : SWAP_WRITE);
+
+    spinlock_acquire(&coremap_lock);
+    if (coremap[i].refcount == 1) {
+        coremap[i].refcount = 0;
+        coremap[i].vaddr &= ~(vaddr_t)0xc;
+        freed = true;
+    }
+    spinlock_release(&coremap_lock);
+    if (!freed)
+        putSharedPage(frame);
+    VMTRACE(VMTR_EVICT, frame, slot_used);
+    return freed;
+}
+
+/*
+ * Evicts a frame shared copy-on-write after a fork, for all the
+ * address spaces mapping it at once. The frames are visited round-robin
+ * like the ones of evictPage. Returns ENOMEM if none could be freed.
+ */
+static int evictShared(unsigned *victim)
+{
+    unsigned i, n;
+    bool found;
+
+    lock_acquire(reclaim_lock);
+    for (n = 0; n < coremapSize; n++)
+    {
+        spinlock_acquire(&coremap_lock);
+        i = swapvictim();
+        found = CUSED(i) && !CRES(i) && CCOW(i) && coremap[i].refcount > 0;
+        if (found)
+            coremap[i].refcount++; //ours, keeps the frame while it is swapped out
+        spinlock_release(&coremap_lock);
+        if (found && evictSharedFrame(i))
+        {
+            lock_release(reclaim_lock);
+            vm_stats_inc(COW_EVICT);
+            *victim = i;
+            return 0;
+        }
+    }
+    lock_release(reclaim_lock);
+    return ENOMEM;
+}
+
+#if OPT_PAGECACHE
+/*
+ * Takes a page of a shared file mapping away from all the address spaces
+ * mapping it, dirty mappings writing it back to the file first, and gets
+ * its frame from the page cache. Locked mappings, and ones whose writeback
+ * failed, keep the page. Returns ENOMEM if no frame could be freed.
+ */
+static int evictFilePage(unsigned *victim)
+{
+    struct addrspace *owner;
+    paddr_t frame;
+    unsigned n;
+    int pid;
+
+    lock_acquire(reclaim_lock);
+    for (n = 0; n < coremapSize && (frame = pagecache_file_victim()) != 0; n++)
+    {
+        pid = 0;
+        while ((owner = proc_next_as(&pid)) != NULL)
+        {
+            lock_acquire(owner->pt_lock);
+            pt_entry *pt = owner->as_pt;
+            for (unsigned j = 0; j < owner->npages; j++)
+            {
+                if (!pt[j].in_mem || !pt[j].shared || !pt[j].mapped || pt[j].paddr != frame || pt[j].locked)
+                    continue;
+                tlb_shootdown(owner, pt[j].vaddr); //writes now fault and wait for pt_lock
+                if (pt[j].dirty && as_mmap_writeback(owner, &pt[j]) != 0)
+                    continue;
+                pt[j].in_mem = 0;
+                pt[j].paddr = 0;
+                pt[j].dirty = 0;
+                pt[j].shared = 0;
+                pt[j].readahead = 0;
+                as_rss_add(owner, -1);
+                pagecache_put(frame); //never the last reference, pagecache_file_victim took one
+            }
+            lock_release(owner->pt_lock);
+        }
+        if (pagecache_take(frame))
+        {
+            lock_release(reclaim_lock);
+            VMTRACE(VMTR_EVICT, frame, 1);
+            *victim = (frame - firstpaddr) / PAGE_SIZE;
+            return 0;
+        }
+    }
+    lock_release(reclaim_lock);
+    return ENOMEM;
+}
+#endif
+
+/*
+ * Called by as_destroy after freeAs: a reclaim that found the address space
+ * before that may still be looking at its page table.
+ */
+void reclaimWait(void)
+{
+    lock_acquire(reclaim_lock);
+    lock_release(reclaim_lock);
+}
+
 static paddr_t getPage(bool is_reserved, vaddr_t vaddr, struct addrspace* as)
 {
-    paddr_t addr;
     unsigned i;
+    int result = ENOMEM;
     spinlock_acquire(&coremap_lock);
 
     if(! _isCoremapActive()) {
@@ -105,54 +509,51 @@ static paddr_t getPage(bool is_reserved, vaddr_t vaddr, struct addrspace* as)
         //look for an available entry in the coremap
         if (!CUSED(i) && !CRES(i))
         {
-            addr = i ;
             set_coreentry(i,vaddr,is_reserved, as); //mark the entry in the coremap as filled
             coremap[i].allocpages = 1;
             spinlock_release(&coremap_lock);
-            break;
+            return i * PAGE_SIZE + firstpaddr;
         }
     }
-    if (i == coremapSize) //no available entries in the coremap
-    {
-        addr = 0;
-        if (as != NULL)
-        {
-            if (getAvailableSwap()) //check if the swap file has free space
-            {
-                pt_entry *pt = as->as_pt;
-                while(1) {
-                    // look for an entry that is not reserved and in the same 	
-	                // address space of the current process
-                    i = swapvictim();
-                    if(!(coremap[i].vaddr & 0x1))
-                        if(coremap[i].as == as)
-                            break;
-                } 
-                   
-                spinlock_release(&coremap_lock);
-                lock_acquire(as->pt_lock);
-                for (unsigned j = 0; j<as -> npages; j++)
-                {
-                    if (pt[j].paddr == i * PAGE_SIZE + firstpaddr)
-                    {
-                        if(pt[j].rwx & 2) { // if page is not readonly, swap it out
-                            KASSERT(swap_out(&pt[j].paddr) == 0);
-                            vm_stats_inc(SWAP_WRITE);
-                            pt[j].in_swap = 1;
-                        } else pt[j].paddr = 0; //just erase the entry, it will be read again from the ELF if needed
-                        pt[j].in_mem = 0; //update its info in the page table
-                        tlb_invalidate_vaddr(pt[j].vaddr); //invalidate the entry in the TLB
-                        addr = i ;
-                        break; //swaps out first page found
-                    }
-                }
-                lock_release(as->pt_lock);
-            } else { //we swapped out already 9MB
-                panic("Not enough memory in Swap File");
-            }
+    spinlock_release(&coremap_lock);
+
+    //no available entries in the coremap
+    if (as == NULL) //kernel memory and page tables are never swapped out
+        return 0;
+#if OPT_PAGECACHE
+    paddr_t cached = pagecache_reclaim(); //clean and unmapped, cheaper than any eviction
+    if (cached != 0) {
+        i = (cached - firstpaddr) / PAGE_SIZE;
+        result = 0;
+    }
+#endif
+    if (result && getAvailableSwap()) //check if the swap file has free space
+        result = evictPage(as, vaddr, &i);
+    if (result && getAvailableSwap()) //frames shared copy-on-write, swapped out for all their users at once
+        result = evictShared(&i);
+#if OPT_PAGECACHE
+    if (result) //pages of shared file mappings go back to their file, no swap needed
+        result = evictFilePage(&i);
+#endif
+#if OPT_SHM
+    if (result) {
+        paddr_t shared = shm_reclaim(); //shared memory pages, written to swap as well
+        if (shared != 0) {
+            i = (shared - firstpaddr) / PAGE_SIZE;
+            result = 0;
         }
-    } 
-    return addr * PAGE_SIZE + firstpaddr;
+    }
+#endif
+    if (result && !getAvailableSwap()) //we swapped out already all the swap devices
+        result = oomReclaim(as, &i);
+    if (result)
+        return 0;
+
+    spinlock_acquire(&coremap_lock);
+    set_coreentry(i, vaddr, false, as); //the evicted frame now holds vaddr
+    coremap[i].allocpages = 1;
+    spinlock_release(&coremap_lock);
+    return i * PAGE_SIZE + firstpaddr;
 }
 
 static paddr_t getMultiplePages(unsigned npages, bool is_reserved, struct addrspace* as)
@@ -192,7 +593,9 @@ static paddr_t getMultiplePages(unsigned npages, bool is_reserved, struct addrsp
 	}
 	else
 	{
-        panic("Multiple page swapping is not required for on demand page loading");
+        //multiple page swapping is not required for on demand page loading
+        spinlock_release(&coremap_lock);
+        return 0;
 	}
 
     spinlock_release(&coremap_lock);
@@ -219,6 +622,141 @@ void freepages(paddr_t paddr) {
     spinlock_release(&coremap_lock);
 }
 
+//hands the frame at paddr over to as, NULL when the page cache keeps it
+void setPageOwner(paddr_t paddr, struct addrspace *as) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    spinlock_acquire(&coremap_lock);
+    KASSERT(CUSED(i) && !CRES(i));
+    coremap[i].as = as;
+    spinlock_release(&coremap_lock);
+}
+
+/*
+ * Shared frames belong to none of the address spaces mapping them, so they
+ * are not released by freeAs: each mapping holds a reference instead,
+ * dropped on the first write or in as_destroy. Copy-on-write ones (cow set,
+ * the others are shm pages) are evicted by evictShared.
+ */
+void sharePage(paddr_t paddr, bool cow) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    spinlock_acquire(&coremap_lock);
+    KASSERT(CUSED(i) && !CRES(i));
+    if (coremap[i].refcount == 0) { //first fork sharing it, the owner keeps a reference
+        coremap[i].as = NULL;
+        coremap[i].refcount = 2;
+    } else
+        coremap[i].refcount++;
+    if (cow)
+        coremap[i].vaddr |= 0x8;
+    spinlock_release(&coremap_lock);
+}
+
+//true if as was the last one mapping the frame, which is now its own again
+bool claimSharedPage(paddr_t paddr, struct addrspace *as) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    bool claimed = false;
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[i].refcount > 0);
+    if (coremap[i].refcount == 1) {
+        coremap[i].refcount = 0;
+        coremap[i].as = as;
+        coremap[i].vaddr &= ~(vaddr_t)0xc; //a shared frame back to its last user is a private one again
+        claimed = true;
+    }
+    spinlock_release(&coremap_lock);
+    return claimed;
+}
+
+/*
+ * Same-page merging: the private frame of as becomes a merged one, shared
+ * copy-on-write as after a fork but with a single reference for now.
+ * False if as does not own the frame (anymore) or it is pinned.
+ */
+bool mergePage(paddr_t paddr, struct addrspace *as) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    bool merged = false;
+    spinlock_acquire(&coremap_lock);
+    if (CUSED(i) && !CRES(i) && coremap[i].as == as && coremap[i].refcount == 0) {
+        coremap[i].as = NULL;
+        coremap[i].refcount = 1;
+        coremap[i].vaddr |= 0xc; //also copy-on-write, so evictShared swaps it out like a forked one
+        merged = true;
+    }
+    spinlock_release(&coremap_lock);
+    return merged;
+}
+
+//takes a reference to the merged frame, false if it was split or freed since
+bool refMergedPage(paddr_t paddr) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    bool merged = false;
+    spinlock_acquire(&coremap_lock);
+    if (CUSED(i) && CMERGED(i) && coremap[i].refcount > 0) {
+        coremap[i].refcount++;
+        merged = true;
+    }
+    spinlock_release(&coremap_lock);
+    return merged;
+}
+
+//merged frames in use and the page table entries mapping them
+void countMergedPages(unsigned *shared, unsigned *sharing) {
+    *shared = *sharing = 0;
+    spinlock_acquire(&coremap_lock);
+    for (unsigned i = 0; i < coremapSize; i++) {
+        if (CUSED(i) && CMERGED(i)) {
+            (*shared)++;
+            *sharing += coremap[i].refcount;
+        }
+    }
+    spinlock_release(&coremap_lock);
+}
+
+/*
+ * mlock: a frame of as marked reserved, as kernel frames are, is skipped by
+ * every replacement policy but still released by freeAs. Frames owned by no
+ * address space (shared ones) are left alone, mlock splits them first.
+ */
+void pinPage(paddr_t paddr, struct addrspace *as) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    spinlock_acquire(&coremap_lock);
+    if (CUSED(i) && coremap[i].as == as)
+        coremap[i].vaddr |= 0x1;
+    spinlock_release(&coremap_lock);
+}
+
+void unpinPage(paddr_t paddr, struct addrspace *as) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    spinlock_acquire(&coremap_lock);
+    if (CUSED(i) && coremap[i].as == as)
+        coremap[i].vaddr &= ~(vaddr_t)0x1;
+    spinlock_release(&coremap_lock);
+}
+
+//references to a shared frame, 0 if it has a single owner
+unsigned getPageRefs(paddr_t paddr) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    spinlock_acquire(&coremap_lock);
+    unsigned refs = coremap[i].refcount;
+    spinlock_release(&coremap_lock);
+    return refs;
+}
+
+void putSharedPage(paddr_t paddr) {
+    unsigned i = (paddr-firstpaddr) / PAGE_SIZE;
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[i].refcount > 0);
+    if (--coremap[i].refcount == 0) {
+        coremap[i].allocpages = 0;
+        set_empty(i);
+    }
+    spinlock_release(&coremap_lock);
+}
+
+unsigned getRamPages() {
+    return coremapSize;
+}
+
 static unsigned getAvailableRam() {
     spinlock_acquire(&coremap_lock);
     unsigned ret = coremapSize - ram_used;
@@ -226,14 +764,19 @@ static unsigned getAvailableRam() {
     return ret;
 }
 
+//frames that are never chosen as swap victims, used by the page tables and the swap pool
+paddr_t reservePages(unsigned npages)
+{
+    return npages > 1 ? getMultiplePages(npages,true,NULL) : getPage(true,0,NULL);
+}
+
 paddr_t ptAlloc(unsigned npages)
 {   
     unsigned numpages = DIVROUNDUP(sizeof(pt_entry)*npages,PAGE_SIZE);
     
     if (getAvailableRam() > numpages)
-        return (numpages > 1 ? getMultiplePages(numpages,true,NULL) : getPage(true,0,NULL));
-    else
-        panic("No available space for pageTable in RAM\n");
-        return 0;
+        return reservePages(numpages);
+    kprintf("No available space for pageTable in RAM\n");
+    return 0;
 }
 
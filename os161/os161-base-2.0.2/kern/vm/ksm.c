@@ -0,0 +1,331 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <addrspace.h>
+#include <pt.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <vm_tlb.h>
+#include <ksm.h>
+
+#define KSM_HASHSIZE 64
+#define KSMNONE 0xffff
+#define KSM_BUCKET(h) ((h) % KSM_HASHSIZE)
+
+typedef struct ksm_stable {
+    paddr_t paddr;   //merged frame, owned by no address space
+    uint32_t hash;
+    uint16_t next;   //next entry in the same hash bucket
+    bool valid : 1;
+} ksm_stable;
+
+typedef struct ksm_unstable {
+    struct addrspace *as; //NULL once merged or forgotten
+    vaddr_t vaddr;
+    uint32_t hash;
+    uint16_t next;
+} ksm_unstable;
+
+unsigned ksm_pages_to_scan = 64;
+unsigned ksm_sleep_secs = 1;
+
+static struct lock *ksm_lock;
+static bool ksm_run = false;
+static bool ksm_started = false;
+static struct addrspace *spaces[KSM_MAXSPACES];
+static ksm_stable stable[KSM_MAXSTABLE];
+static uint16_t stablehash[KSM_HASHSIZE];
+static ksm_unstable unstable[KSM_MAXUNSTABLE];
+static uint16_t unstablehash[KSM_HASHSIZE];
+static unsigned nunstable = 0;
+static unsigned cursor_space = 0, cursor_page = 0; //next page table entry looked at
+
+//FNV-1a over the words of the frame
+static uint32_t page_hash(paddr_t paddr)
+{
+    const uint32_t *w = (const uint32_t *)PADDR_TO_KVADDR(paddr);
+    uint32_t h = 2166136261u;
+    for (unsigned k = 0; k < PAGE_SIZE / sizeof(uint32_t); k++)
+        h = (h ^ w[k]) * 16777619u;
+    return h;
+}
+
+static bool same_page(paddr_t a, paddr_t b)
+{
+    return memcmp((const void *)PADDR_TO_KVADDR(a), (const void *)PADDR_TO_KVADDR(b), PAGE_SIZE) == 0;
+}
+
+//private resident page of a writable segment, in a frame of its own
+static bool mergeable(pt_entry *pte)
+{
+    return pte != NULL && pte->in_mem && (pte->rwx & 2) && !pte->cow && !pte->zero && !pte->shared &&
+        !pte->shm && !pte->mapped && !pte->locked;
+}
+
+static void unstable_reset(void)
+{
+    for (unsigned h = 0; h < KSM_HASHSIZE; h++)
+        unstablehash[h] = KSMNONE;
+    nunstable = 0;
+}
+
+static void stable_add(paddr_t paddr, uint32_t hash)
+{
+    unsigned e;
+    for (e = 0; e < KSM_MAXSTABLE && stable[e].valid; e++);
+    if (e == KSM_MAXSTABLE) //the frame stays merged, it is just not offered to new pages
+        return;
+    stable[e].paddr = paddr;
+    stable[e].hash = hash;
+    stable[e].valid = 1;
+    stable[e].next = stablehash[KSM_BUCKET(hash)];
+    stablehash[KSM_BUCKET(hash)] = e;
+}
+
+static void stable_free(uint16_t e)
+{
+    uint16_t *link;
+    for (link = &stablehash[KSM_BUCKET(stable[e].hash)]; *link != e; link = &stable[*link].next)
+        KASSERT(*link != KSMNONE);
+    *link = stable[e].next;
+    stable[e].valid = 0;
+}
+
+/*
+ * Maps the page of as at vaddr to the merged frame, if they are still
+ * identical, and frees its own frame. Returns ENOENT if the frame has been
+ * split by its last user meanwhile.
+ */
+static int merge_into(struct addrspace *as, vaddr_t vaddr, paddr_t frame)
+{
+    if (!refMergedPage(frame)) //our reference keeps it merged while comparing
+        return ENOENT;
+    lock_acquire(as->pt_lock);
+    pt_entry *pte = as_lookup_pte(as, vaddr);
+    if (mergeable(pte))
+        tlb_shootdown(as, vaddr); //as may be running elsewhere: its writes now fault and wait for pt_lock
+    if (!mergeable(pte) || !same_page(pte->paddr, frame))
+    {
+        lock_release(as->pt_lock);
+        putSharedPage(frame);
+        return EAGAIN;
+    }
+    freepages(pte->paddr);
+    pte->paddr = frame;
+    pte->cow = 1;
+    lock_release(as->pt_lock);
+    vm_stats_inc(KSM_MERGE);
+    return 0;
+}
+
+//turns the frame of the candidate page into a merged one, still mapped by it alone
+static int promote(struct addrspace *as, vaddr_t vaddr, uint32_t hash, paddr_t *frame)
+{
+    lock_acquire(as->pt_lock);
+    pt_entry *pte = as_lookup_pte(as, vaddr);
+    if (!mergeable(pte) || page_hash(pte->paddr) != hash || !mergePage(pte->paddr, as))
+    {
+        lock_release(as->pt_lock);
+        return EAGAIN;
+    }
+    pte->cow = 1;
+    tlb_shootdown(as, vaddr); //no writable entry may be left for the frame now shared
+    *frame = pte->paddr;
+    lock_release(as->pt_lock);
+    return 0;
+}
+
+//undoes promote when no other page could be merged into the frame
+static void demote(struct addrspace *as, vaddr_t vaddr, paddr_t frame)
+{
+    lock_acquire(as->pt_lock);
+    pt_entry *pte = as_lookup_pte(as, vaddr);
+    //still mapped by as alone: not split, swapped out or merged into meanwhile
+    if (pte != NULL && pte->in_mem && pte->cow && pte->paddr == frame && claimSharedPage(frame, as))
+    {
+        pte->cow = 0;
+        tlb_shootdown(as, vaddr); //a read-only entry left elsewhere would now fault as a bad write
+    }
+    lock_release(as->pt_lock);
+}
+
+/*
+ * Looks at entry idx of the page table of as. Returns false if the table
+ * is shorter. ksm_lock must be held.
+ */
+static bool scan_page(struct addrspace *as, unsigned idx)
+{
+    uint16_t e;
+    paddr_t frame;
+
+    lock_acquire(as->pt_lock);
+    if (idx >= as->npages)
+    {
+        lock_release(as->pt_lock);
+        return false;
+    }
+    pt_entry *pte = &as->as_pt[idx];
+    vaddr_t vaddr = pte->vaddr;
+    if (!mergeable(pte))
+    {
+        lock_release(as->pt_lock);
+        return true;
+    }
+    uint32_t hash = page_hash(pte->paddr);
+    lock_release(as->pt_lock);
+
+    for (e = stablehash[KSM_BUCKET(hash)]; e != KSMNONE; )
+    {
+        uint16_t next = stable[e].next;
+        if (stable[e].hash == hash)
+        {
+            int result = merge_into(as, vaddr, stable[e].paddr);
+            if (result == 0)
+                return true;
+            if (result == ENOENT)
+                stable_free(e);
+        }
+        e = next;
+    }
+
+    for (e = unstablehash[KSM_BUCKET(hash)]; e != KSMNONE; e = unstable[e].next)
+    {
+        ksm_unstable *u = &unstable[e];
+        if (u->as == NULL || u->hash != hash || (u->as == as && u->vaddr == vaddr))
+            continue;
+        if (promote(u->as, u->vaddr, hash, &frame) == 0)
+        {
+            if (merge_into(as, vaddr, frame) == 0)
+                stable_add(frame, hash);
+            else
+                demote(u->as, u->vaddr, frame);
+            u->as = NULL;
+            return true;
+        }
+    }
+
+    if (nunstable < KSM_MAXUNSTABLE)
+    {
+        e = nunstable++;
+        unstable[e].as = as;
+        unstable[e].vaddr = vaddr;
+        unstable[e].hash = hash;
+        unstable[e].next = unstablehash[KSM_BUCKET(hash)];
+        unstablehash[KSM_BUCKET(hash)] = e;
+    }
+    return true;
+}
+
+//moves the cursor to the next address space, a new round starts after the last one
+static void next_space(void)
+{
+    cursor_page = 0;
+    if (++cursor_space == KSM_MAXSPACES)
+    {
+        cursor_space = 0;
+        unstable_reset(); //the candidates may have changed since they were hashed
+    }
+}
+
+static void scan(unsigned budget)
+{
+    unsigned skipped = 0;
+
+    lock_acquire(ksm_lock);
+    while (budget > 0 && skipped <= KSM_MAXSPACES)
+    {
+        struct addrspace *as = spaces[cursor_space];
+        if (as == NULL || !scan_page(as, cursor_page))
+        {
+            next_space();
+            skipped++;
+            continue;
+        }
+        cursor_page++;
+        budget--;
+        skipped = 0;
+    }
+    lock_release(ksm_lock);
+}
+
+static void ksm_loop(void *unused1, unsigned long unused2)
+{
+    (void)unused1;
+    (void)unused2;
+    while (true) {
+        if (ksm_run)
+            scan(ksm_pages_to_scan);
+        clocksleep(ksm_sleep_secs);
+    }
+}
+
+void ksm_init(void)
+{
+    ksm_lock = lock_create("KSM_lock");
+    if (ksm_lock == NULL)
+        panic("Same-page merging lock was not created succesfully\n");
+    for (unsigned h = 0; h < KSM_HASHSIZE; h++)
+        stablehash[h] = KSMNONE;
+    unstable_reset();
+}
+
+void ksm_register(struct addrspace *as)
+{
+    lock_acquire(ksm_lock);
+    for (unsigned k = 0; k < KSM_MAXSPACES; k++) {
+        if (spaces[k] == NULL) {
+            spaces[k] = as;
+            break;
+        }
+    }
+    lock_release(ksm_lock);
+}
+
+//no scan is looking at as once this returns
+void ksm_forget(struct addrspace *as)
+{
+    lock_acquire(ksm_lock);
+    for (unsigned k = 0; k < KSM_MAXSPACES; k++) {
+        if (spaces[k] == as) {
+            spaces[k] = NULL;
+            if (cursor_space == k)
+                cursor_page = 0;
+        }
+    }
+    for (unsigned e = 0; e < nunstable; e++) {
+        if (unstable[e].as == as)
+            unstable[e].as = NULL;
+    }
+    lock_release(ksm_lock);
+}
+
+//enables or disables the scanner, the thread is started the first time
+int ksm_set(bool run, unsigned pages, unsigned secs)
+{
+    if (pages == 0 || secs == 0)
+        return EINVAL;
+    ksm_pages_to_scan = pages;
+    ksm_sleep_secs = secs;
+    if (run && !ksm_started) {
+        int result = thread_fork("ksmd", NULL, ksm_loop, NULL, 0);
+        if (result)
+            return result;
+        ksm_started = true;
+    }
+    ksm_run = run;
+    return 0;
+}
+
+void ksm_print(void)
+{
+    unsigned shared, sharing;
+
+    countMergedPages(&shared, &sharing);
+    kprintf("Same-page merging: %s, %u pages every %u s\n", ksm_run ? "on" : "off",
+        ksm_pages_to_scan, ksm_sleep_secs);
+    kprintf("Pages Shared = %u, Pages Saved = %u\n", shared, sharing - shared);
+}
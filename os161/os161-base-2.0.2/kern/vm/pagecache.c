@@ -0,0 +1,379 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <vnode.h>
+#include <synch.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <pagecache.h>
+
+#define PC_MAXENTRIES 256
+#define PC_HASHSIZE 64
+#define PCNONE 0xffff
+#define PC_HASH(v, vaddr) ((((uintptr_t)(v) >> 4) ^ ((vaddr) >> 12)) % PC_HASHSIZE)
+//vaddr key of a page of a shared file mapping, whatever address it is mapped at: odd, unlike ELF pages
+#define PC_FILEKEY(offset) ((vaddr_t)(offset) | 1)
+
+typedef struct pc_entry {
+    struct vnode *v;    //executable or mapped file the page comes from, kept alive with VOP_INCREF
+    off_t offset;       //offset of the page in the file
+    vaddr_t vaddr;      //PC_FILEKEY for a page of a file mapping
+    paddr_t paddr;      //cached frame, owned by no address space
+    unsigned refcount;  //page table entries mapping the frame
+    uint32_t seq;       //last release, the oldest unreferenced page is reclaimed first
+    uint16_t next;      //next entry in the same hash bucket
+    bool valid : 1;
+    bool readahead : 1; //cached by read-ahead and not mapped yet
+} pc_entry;
+
+static struct lock *pc_lock;
+static pc_entry pcentries[PC_MAXENTRIES];
+static uint16_t pchash[PC_HASHSIZE];
+static uint32_t pcseq = 0;
+static unsigned pc_hand = 0; //next entry looked at by pagecache_file_victim
+
+static int entry_lookup(struct vnode *v, off_t offset, vaddr_t vaddr)
+{
+    uint16_t e;
+    for (e = pchash[PC_HASH(v, vaddr)]; e != PCNONE; e = pcentries[e].next) {
+        if (pcentries[e].v == v && pcentries[e].offset == offset && pcentries[e].vaddr == vaddr)
+            return e;
+    }
+    return -1;
+}
+
+static int entry_by_paddr(paddr_t paddr)
+{
+    for (unsigned e = 0; e < PC_MAXENTRIES; e++) {
+        if (pcentries[e].valid && pcentries[e].paddr == paddr)
+            return e;
+    }
+    return -1;
+}
+
+static int entry_free_index(void)
+{
+    for (unsigned e = 0; e < PC_MAXENTRIES; e++) {
+        if (!pcentries[e].valid)
+            return e;
+    }
+    return -1;
+}
+
+static void entry_insert(int e, struct vnode *v, off_t offset, vaddr_t vaddr, paddr_t paddr)
+{
+    pc_entry *p = &pcentries[e];
+    VOP_INCREF(v);
+    p->v = v;
+    p->offset = offset;
+    p->vaddr = vaddr;
+    p->paddr = paddr;
+    p->refcount = 0;
+    p->seq = pcseq++;
+    p->readahead = 0;
+    p->valid = 1;
+    p->next = pchash[PC_HASH(v, vaddr)];
+    pchash[PC_HASH(v, vaddr)] = e;
+}
+
+//the frame is left to the caller
+static void entry_remove(int e)
+{
+    pc_entry *p = &pcentries[e];
+    uint16_t *link;
+
+    for (link = &pchash[PC_HASH(p->v, p->vaddr)]; *link != e; link = &pcentries[*link].next)
+        KASSERT(*link != PCNONE);
+    *link = p->next;
+    VOP_DECREF(p->v);
+    p->valid = 0;
+}
+
+//drops the coldest unreferenced page, returns its entry index or -1 if every page is mapped
+static int entry_evict(void)
+{
+    int victim = -1;
+
+    for (unsigned e = 0; e < PC_MAXENTRIES; e++) {
+        if (pcentries[e].valid && pcentries[e].refcount == 0 &&
+            (victim < 0 || (int32_t)(pcentries[e].seq - pcentries[victim].seq) < 0))
+            victim = e;
+    }
+    if (victim >= 0)
+        entry_remove(victim);
+    return victim;
+}
+
+/*
+ * Reads the page of seg at vaddr into frame, with a single read together
+ * with up to ra following pages of the segment not cached yet.
+ * Those enter the cache unreferenced, in frames that are free at the moment
+ * and in free entries only. pc_lock must be held.
+ */
+static int pagecache_fill(struct vnode *v, segment_t *seg, vaddr_t vaddr, unsigned ra, paddr_t frame)
+{
+    paddr_t paddrs[ELF_MAXREADAHEAD + 1];
+    int entries[ELF_MAXREADAHEAD + 1];
+    vaddr_t first = vaddr;
+    unsigned n = 0, max, k;
+    int result;
+
+    if (elf_cluster_pages(seg, vaddr, 1) == 0) { //the first page of a segment has its own layout
+        result = load_elf_ondemand(seg, frame, vaddr);
+        if (result)
+            return result;
+        first += PAGE_SIZE;
+    }
+    max = elf_cluster_pages(seg, first, ra + (first == vaddr));
+    for (k = 0; k < max; k++) {
+        vaddr_t va = first + k * PAGE_SIZE;
+        off_t offset = seg->offset + (va - seg->start);
+        if (va == vaddr) {
+            entries[n] = -1;
+            paddrs[n++] = frame;
+            continue;
+        }
+        int e = entry_free_index();
+        if (e < 0 || entry_lookup(v, offset, va) >= 0)
+            break; //the window must stay contiguous
+        paddr_t paddr = getPages(1, va, NULL); //free frames only, owned by no address space
+        if (paddr == 0)
+            break;
+        entry_insert(e, v, offset, va, paddr); //claims the entry, removed again on failure
+        entries[n] = e;
+        paddrs[n++] = paddr;
+    }
+    if (n == 0)
+        return 0;
+
+    result = load_elf_cluster(seg, paddrs, first, n);
+    for (k = 0; k < n; k++) {
+        if (entries[k] < 0)
+            continue;
+        if (result) {
+            entry_remove(entries[k]);
+            freepages(paddrs[k]);
+        } else
+            pcentries[entries[k]].readahead = 1;
+    }
+    if (result == 0)
+        vm_stats_add(ELF_READAHEAD, n - (first == vaddr));
+    return result;
+}
+
+void pagecache_init(void)
+{
+    for (unsigned h = 0; h < PC_HASHSIZE; h++)
+        pchash[h] = PCNONE;
+    pc_lock = lock_create("PC_lock");
+    if (pc_lock == NULL)
+        panic("Page cache lock was not created succesfully\n");
+}
+
+/*
+ * Returns in paddr the cached frame holding the page of seg at vaddr, taking
+ * a reference on it. On a miss the page is read from the ELF of as into a new
+ * frame, which then stops belonging to as, with a read-ahead window of ra pages. Returns an error if the page could
+ * not be cached: the caller loads a private copy instead.
+ */
+int pagecache_get(struct addrspace *as, segment_t *seg, vaddr_t vaddr, unsigned ra, paddr_t *paddr)
+{
+    off_t offset = seg->offset + (vaddr - seg->start);
+    paddr_t frame;
+    int e, result;
+
+    lock_acquire(pc_lock);
+    e = entry_lookup(as->v, offset, vaddr);
+    if (e >= 0)
+        goto hit;
+    lock_release(pc_lock);
+
+    frame = getPages(1, vaddr, as); //may evict, so not under pc_lock
+    if (frame == 0)
+        return ENOMEM;
+
+    lock_acquire(pc_lock);
+    e = entry_lookup(as->v, offset, vaddr);
+    if (e >= 0) { //another process loaded it meanwhile
+        freepages(frame);
+        goto hit;
+    }
+    e = entry_free_index();
+    if (e < 0 && (e = entry_evict()) >= 0)
+        freepages(pcentries[e].paddr);
+    if (e < 0) {
+        lock_release(pc_lock);
+        freepages(frame);
+        return ENOSPC;
+    }
+
+    bzero((void *)PADDR_TO_KVADDR(frame), PAGE_SIZE); //the tail past filesize must read as zero
+    entry_insert(e, as->v, offset, vaddr, frame); //read-ahead must not take this entry
+    result = pagecache_fill(as->v, seg, vaddr, ra, frame);
+    if (result) {
+        entry_remove(e);
+        lock_release(pc_lock);
+        freepages(frame);
+        return result;
+    }
+    vm_stats_inc(ELF_READ);
+    vm_stats_inc(PAGE_FAULT_DISK);
+    as->ru.ru_elfreads++;
+    setPageOwner(frame, NULL); //from now on freed by the cache only
+    pcentries[e].refcount = 1;
+    lock_release(pc_lock);
+    *paddr = frame;
+    return 0;
+
+hit:
+    if (pcentries[e].readahead) {
+        vm_stats_inc(ELF_READAHEAD_HIT);
+        pcentries[e].readahead = 0;
+    }
+    pcentries[e].refcount++;
+    *paddr = pcentries[e].paddr;
+    lock_release(pc_lock);
+    vm_stats_inc(PAGE_CACHE_HIT);
+    return 0;
+}
+
+/*
+ * Page of a shared file mapping, as pagecache_get: all the processes mapping
+ * the file get the same frame, so that each one sees the writes of the
+ * others before they reach the file. Writers write it back themselves, and
+ * the page leaves the cache with its last mapping.
+ */
+int pagecache_get_file(struct addrspace *as, segment_t *seg, vaddr_t vaddr, paddr_t *paddr)
+{
+    off_t offset = seg->offset + (vaddr - seg->start);
+    paddr_t frame;
+    int e, result;
+
+    KASSERT(seg->type == SEG_MMAP);
+    lock_acquire(pc_lock);
+    e = entry_lookup(seg->vn, offset, PC_FILEKEY(offset));
+    if (e >= 0)
+        goto hit;
+    lock_release(pc_lock);
+
+    frame = getPages(1, vaddr, as); //may evict, so not under pc_lock
+    if (frame == 0)
+        return ENOMEM;
+
+    lock_acquire(pc_lock);
+    e = entry_lookup(seg->vn, offset, PC_FILEKEY(offset));
+    if (e >= 0) { //another process loaded it meanwhile
+        freepages(frame);
+        goto hit;
+    }
+    e = entry_free_index();
+    if (e < 0 && (e = entry_evict()) >= 0)
+        freepages(pcentries[e].paddr);
+    if (e < 0) {
+        lock_release(pc_lock);
+        freepages(frame);
+        return ENOSPC;
+    }
+
+    entry_insert(e, seg->vn, offset, PC_FILEKEY(offset), frame);
+    result = as_mmap_fill(seg, frame, vaddr);
+    if (result) {
+        entry_remove(e);
+        lock_release(pc_lock);
+        freepages(frame);
+        return result;
+    }
+    vm_stats_inc(PAGE_FAULT_DISK);
+    setPageOwner(frame, NULL); //from now on freed by the cache only
+    pcentries[e].refcount = 1;
+    lock_release(pc_lock);
+    *paddr = frame;
+    return 0;
+
+hit:
+    pcentries[e].refcount++;
+    *paddr = pcentries[e].paddr;
+    lock_release(pc_lock);
+    vm_stats_inc(PAGE_CACHE_HIT);
+    return 0;
+}
+
+//a new page table entry maps paddr, used by as_copy
+void pagecache_ref(paddr_t paddr)
+{
+    lock_acquire(pc_lock);
+    int e = entry_by_paddr(paddr);
+    KASSERT(e >= 0);
+    pcentries[e].refcount++;
+    lock_release(pc_lock);
+}
+
+void pagecache_put(paddr_t paddr)
+{
+    lock_acquire(pc_lock);
+    int e = entry_by_paddr(paddr);
+    KASSERT(e >= 0 && pcentries[e].refcount > 0);
+    if (--pcentries[e].refcount == 0 && (pcentries[e].vaddr & 1)) {
+        //file pages are only cached while mapped, write() does not update them
+        entry_remove(e);
+        freepages(paddr);
+    } else if (pcentries[e].refcount == 0)
+        pcentries[e].seq = pcseq++;
+    lock_release(pc_lock);
+}
+
+/*
+ * Next page of a shared file mapping to take away from its mappers, round
+ * robin, with a reference for the caller, which then unmaps it everywhere
+ * and calls pagecache_take. Returns 0 if no such page is mapped.
+ */
+paddr_t pagecache_file_victim(void)
+{
+    paddr_t paddr = 0;
+
+    lock_acquire(pc_lock);
+    for (unsigned n = 0; n < PC_MAXENTRIES && paddr == 0; n++) {
+        pc_entry *p = &pcentries[pc_hand];
+        pc_hand = (pc_hand + 1) % PC_MAXENTRIES;
+        if (p->valid && (p->vaddr & 1) && p->refcount > 0) {
+            p->refcount++;
+            paddr = p->paddr;
+        }
+    }
+    lock_release(pc_lock);
+    return paddr;
+}
+
+//drops the reference of pagecache_file_victim: true if it was the last one, the frame is then the caller's
+bool pagecache_take(paddr_t paddr)
+{
+    bool taken = false;
+
+    lock_acquire(pc_lock);
+    int e = entry_by_paddr(paddr);
+    KASSERT(e >= 0 && pcentries[e].refcount > 0);
+    if (pcentries[e].refcount == 1) {
+        entry_remove(e);
+        taken = true;
+    } else
+        pcentries[e].refcount--;
+    lock_release(pc_lock);
+    return taken;
+}
+
+/*
+ * Gives up the frame of the coldest unreferenced page to the caller, which
+ * becomes its owner. Returns 0 if every cached page is mapped by someone.
+ */
+paddr_t pagecache_reclaim(void)
+{
+    paddr_t paddr = 0;
+
+    lock_acquire(pc_lock);
+    int e = entry_evict();
+    if (e >= 0)
+        paddr = pcentries[e].paddr;
+    lock_release(pc_lock);
+    return paddr;
+}
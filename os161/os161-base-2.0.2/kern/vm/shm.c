@@ -0,0 +1,285 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <synch.h>
+#include <coremap.h>
+#include <swapfile.h>
+#include <vmstats.h>
+#include <shm.h>
+
+typedef struct shm_page {
+    paddr_t paddr;   //frame, or swap slot when in_swap
+    bool in_mem : 1;
+    bool in_swap : 1;
+} shm_page;
+
+typedef struct shm_attachment {
+    struct addrspace *as;
+    vaddr_t vaddr;   //start of the segment the object is attached as
+} shm_attachment;
+
+struct shm_object {
+    int key;
+    unsigned npages;
+    unsigned nattach;
+    shm_attachment attach[SHM_MAXATTACH];
+    shm_page *pages;
+    bool valid : 1;
+    bool removed : 1; //no new attachments, freed with the last detach
+};
+
+/*
+ * Lock order: shm_lock before pt_lock, reclaim takes both. Page table
+ * locks are therefore released before calling into this file.
+ */
+static struct lock *shm_lock;
+static struct shm_object shmobjects[SHM_MAXOBJECTS];
+static unsigned shm_hand = 0; //next page looked at by shm_reclaim, across all the objects
+
+static struct shm_object *object_lookup(int id)
+{
+    if (id < 0 || id >= SHM_MAXOBJECTS || !shmobjects[id].valid || shmobjects[id].removed)
+        return NULL;
+    return &shmobjects[id];
+}
+
+static void object_free(struct shm_object *obj)
+{
+    for (unsigned k = 0; k < obj->npages; k++) {
+        if (obj->pages[k].in_mem)
+            putSharedPage(obj->pages[k].paddr); //entries not unmapped yet keep the frame
+        else if (obj->pages[k].in_swap)
+            clear_swap(obj->pages[k].paddr);
+    }
+    swap_unreserve(obj->npages);
+    kfree(obj->pages);
+    obj->pages = NULL;
+    obj->valid = 0;
+}
+
+static int attach_locked(struct shm_object *obj, struct addrspace *as, vaddr_t vaddr)
+{
+    if (obj->nattach == SHM_MAXATTACH)
+        return ENOSPC;
+    obj->attach[obj->nattach].as = as;
+    obj->attach[obj->nattach].vaddr = vaddr;
+    obj->nattach++;
+    return 0;
+}
+
+void shm_init(void)
+{
+    shm_lock = lock_create("SHM_lock");
+    if (shm_lock == NULL)
+        panic("Shared memory lock was not created succesfully\n");
+}
+
+//returns in id the object with the given key, created with size bytes if there is none
+int shm_get(int key, size_t size, int *id)
+{
+    unsigned npages = DIVROUNDUP(size, PAGE_SIZE);
+    int o, result = 0;
+
+    if (npages == 0 || npages > SHM_MAXPAGES)
+        return EINVAL;
+    lock_acquire(shm_lock);
+    for (o = 0; key != SHM_PRIVATE && o < SHM_MAXOBJECTS; o++) {
+        struct shm_object *obj = object_lookup(o);
+        if (obj != NULL && obj->key == key) {
+            if (npages > obj->npages)
+                result = EINVAL;
+            *id = o;
+            lock_release(shm_lock);
+            return result;
+        }
+    }
+    for (o = 0; o < SHM_MAXOBJECTS && shmobjects[o].valid; o++);
+    if (o == SHM_MAXOBJECTS) {
+        lock_release(shm_lock);
+        return ENOSPC;
+    }
+
+    struct shm_object *obj = &shmobjects[o];
+    obj->pages = kmalloc(npages * sizeof(shm_page));
+    if (obj->pages == NULL) {
+        lock_release(shm_lock);
+        return ENOMEM;
+    }
+    if (swap_reserve(npages)) { //the pages are writable, like any anonymous memory
+        kfree(obj->pages);
+        obj->pages = NULL;
+        lock_release(shm_lock);
+        return ENOMEM;
+    }
+    bzero(obj->pages, npages * sizeof(shm_page));
+    obj->key = key;
+    obj->npages = npages;
+    obj->nattach = 0;
+    obj->removed = 0;
+    obj->valid = 1;
+    *id = o;
+    lock_release(shm_lock);
+    return 0;
+}
+
+int shm_remove(int id)
+{
+    lock_acquire(shm_lock);
+    struct shm_object *obj = object_lookup(id);
+    if (obj == NULL) {
+        lock_release(shm_lock);
+        return EINVAL;
+    }
+    obj->removed = 1;
+    if (obj->nattach == 0)
+        object_free(obj);
+    lock_release(shm_lock);
+    return 0;
+}
+
+int shm_size(int id, unsigned *npages)
+{
+    lock_acquire(shm_lock);
+    struct shm_object *obj = object_lookup(id);
+    if (obj != NULL)
+        *npages = obj->npages;
+    lock_release(shm_lock);
+    return obj == NULL ? EINVAL : 0;
+}
+
+//records that as maps object id at vaddr, npages tells if it is still the object sized by shm_size
+int shm_attach(int id, unsigned npages, struct addrspace *as, vaddr_t vaddr, struct shm_object **obj)
+{
+    int result = EINVAL;
+
+    lock_acquire(shm_lock);
+    struct shm_object *o = object_lookup(id);
+    if (o != NULL && o->npages == npages)
+        result = attach_locked(o, as, vaddr);
+    if (result == 0)
+        *obj = o;
+    lock_release(shm_lock);
+    return result;
+}
+
+//for fork: the child inherits the attachments, even to removed objects
+int shm_attach_object(struct shm_object *obj, struct addrspace *as, vaddr_t vaddr)
+{
+    lock_acquire(shm_lock);
+    KASSERT(obj->valid);
+    int result = attach_locked(obj, as, vaddr);
+    lock_release(shm_lock);
+    return result;
+}
+
+//does nothing if as is not attached, for address spaces whose fork failed half way
+void shm_detach(struct shm_object *obj, struct addrspace *as)
+{
+    unsigned a;
+
+    lock_acquire(shm_lock);
+    for (a = 0; a < obj->nattach && obj->attach[a].as != as; a++);
+    if (a < obj->nattach) {
+        obj->attach[a] = obj->attach[--obj->nattach];
+        if (obj->removed && obj->nattach == 0)
+            object_free(obj);
+    }
+    lock_release(shm_lock);
+}
+
+/*
+ * Returns in paddr the frame of page k of obj, with a reference for the
+ * caller's page table entry. The frame is allocated (zero-filled, or read
+ * from swap) by the first process touching the page.
+ */
+int shm_getpage(struct shm_object *obj, unsigned k, vaddr_t vaddr, struct addrspace *as, paddr_t *paddr)
+{
+    shm_page *p;
+    int result;
+
+    lock_acquire(shm_lock);
+    p = &obj->pages[k];
+    if (p->in_mem)
+        goto hit;
+    lock_release(shm_lock);
+
+    paddr_t frame = getPages(1, vaddr, as); //may evict or reclaim, so not under shm_lock
+    if (frame == 0)
+        return ENOMEM;
+
+    lock_acquire(shm_lock);
+    if (p->in_mem) { //another process brought it in meanwhile
+        freepages(frame);
+        goto hit;
+    }
+    if (p->in_swap) {
+        result = swap_in(&p->paddr, frame, true);
+        if (result) {
+            lock_release(shm_lock);
+            freepages(frame);
+            return result;
+        }
+        p->in_swap = 0;
+        vm_stats_inc(SWAP_READ);
+        as->ru.ru_swapins++;
+    } else
+        bzero((void *)PADDR_TO_KVADDR(frame), PAGE_SIZE);
+    p->paddr = frame;
+    p->in_mem = 1;
+    sharePage(frame, false); //the object keeps a reference, the caller gets the other
+    *paddr = frame;
+    lock_release(shm_lock);
+    return 0;
+
+hit:
+    sharePage(p->paddr, false);
+    *paddr = p->paddr;
+    lock_release(shm_lock);
+    return 0;
+}
+
+/*
+ * Called by getPage when RAM is full: takes a resident page away from the
+ * attached address spaces and writes it to swap, returning its frame, now
+ * owned by no one. Pages a fault is mapping right now, and locked ones, are
+ * skipped without being unmapped.
+ */
+paddr_t shm_reclaim(void)
+{
+    if (!getAvailableSwap())
+        return 0;
+    lock_acquire(shm_lock);
+    for (unsigned n = 0; n < SHM_MAXOBJECTS * SHM_MAXPAGES; n++) {
+        struct shm_object *obj = &shmobjects[shm_hand / SHM_MAXPAGES];
+        unsigned k = shm_hand % SHM_MAXPAGES;
+        shm_hand = (shm_hand + 1) % (SHM_MAXOBJECTS * SHM_MAXPAGES);
+        if (!obj->valid || k >= obj->npages || !obj->pages[k].in_mem)
+            continue;
+
+        //the object's reference plus the mapping ones, anything more is a fault mapping it
+        paddr_t frame = obj->pages[k].paddr, slot = frame;
+        unsigned refs = 1;
+        bool movable = true;
+        for (unsigned a = 0; a < obj->nattach && movable; a++)
+            movable = as_shm_mapping(obj->attach[a].as, obj->attach[a].vaddr + k * PAGE_SIZE, &refs);
+        if (!movable || getPageRefs(frame) != refs)
+            continue;
+        for (unsigned a = 0; a < obj->nattach; a++)
+            as_shm_drop(obj->attach[a].as, obj->attach[a].vaddr + k * PAGE_SIZE);
+        if (getPageRefs(frame) != 1)
+            continue; //locked since, by mlock
+        if (swap_out(&slot))
+            break;
+        bool claimed = claimSharedPage(frame, NULL);
+        KASSERT(claimed);
+        obj->pages[k].paddr = slot;
+        obj->pages[k].in_mem = 0;
+        obj->pages[k].in_swap = 1;
+        vm_stats_inc(SWAP_WRITE);
+        lock_release(shm_lock);
+        return frame;
+    }
+    lock_release(shm_lock);
+    return 0;
+}
@@ -10,124 +10,362 @@
 #include <cpu.h>
 #include <pt.h>
 #include <swapfile.h>
+#include <vmstats.h>
+#include <vmtrace.h>
 #include <vfs.h>
+#include <device.h>
 #include <kern/iovec.h>
 #include <uio.h>
 #include <spl.h>
 #include <stat.h>
 #include <bitmap.h>
 #include <synch.h>
+#include "opt-zswap.h"
 
+#if OPT_ZSWAP
+#include <zswap.h>
+#endif
 
-struct vnode *swapFile;
-off_t swapFileSize;
-struct bitmap *swapMap;
+#define SWAP_MAXDEVS 4
+#define SWAP_DEVSHIFT 24 //a swap slot is (device index << SWAP_DEVSHIFT) | slot inside the device
+#define SWAP_DEV(slot) ((slot) >> SWAP_DEVSHIFT)
+#define SWAP_OFF(slot) ((slot) & ((1 << SWAP_DEVSHIFT) - 1))
+
+typedef struct swap_dev {
+    char *name;
+    struct vnode *vn;    //kept open so that the device stays reserved for swapping
+    struct device *dev;  //the driver is called directly, bypassing the VFS
+    struct bitmap *map;  //one bit per page-sized slot of the device
+    uint16_t *refs;      //page table entries referencing each slot, shared after a fork
+    struct lock *io_lock; //serializes the I/O on this device only
+    unsigned nslots;
+    unsigned used;
+    int prio;            //higher priority devices are filled first
+    unsigned reads;
+    unsigned writes;
+} swap_dev;
+
+static swap_dev swapdevs[SWAP_MAXDEVS];
+static unsigned nswapdevs = 0;
+static unsigned swap_rr = 0; //round-robin cursor among devices of equal priority
 static struct lock *swap_lock;
-const char *swapname = "lhd2"; //this is SWAPFILE, it is automatically created while booting sys161 (we added an instruction in sys161.conf)
-unsigned int short used = 0;
+static unsigned swap_reserved = 0; //writable pages promised to the address spaces
+static int vm_overcommit = VM_OVERCOMMIT_GUESS;
 
+/*
+ * Devices used for swapping at boot, SWAPFILE is lhd2 (we added an instruction in sys161.conf)
+ * and SWAPFILE2 is lhd3. Devices with the same priority are striped round-robin.
+ */
+static const struct {
+    const char *name;
+    int prio;
+} swapconf[] = {
+    { "lhd2", 1 },
+    { "lhd3", 1 },
+};
 
-static void open_swapfile()
+int swapon(const char *devname, int prio)
 {
     int result;
     struct stat stats;
-    result = vfs_swapon(swapname, &swapFile); //opens the swapfile
-    KASSERT(result == 0 && swapFile != NULL);
-    result = VOP_STAT(swapFile, &stats); 
-    KASSERT(result == 0 && stats.st_size % PAGE_SIZE == 0);
-    swapFileSize = stats.st_size; //size of the swapmap bitmap
-    kprintf("SwapFile size : %d\n",(int)swapFileSize);
-}
+    struct vnode *vn;
+    swap_dev *d;
 
+    if (nswapdevs == SWAP_MAXDEVS)
+        return ENOSPC;
+    result = vfs_swapon(devname, &vn); //opens the swap device
+    if (result)
+        return result;
+    result = VOP_STAT(vn, &stats);
+    if (result || stats.st_size < PAGE_SIZE) {
+        vfs_swapoff(devname);
+        return result ? result : EINVAL;
+    }
+
+    lock_acquire(swap_lock);
+    d = &swapdevs[nswapdevs];
+    d->name = kstrdup(devname);
+    d->vn = vn;
+    d->dev = vn->vn_data; //device vnodes keep their struct device here
+    d->nslots = stats.st_size / PAGE_SIZE; //a partial page at the end is not used
+    d->map = bitmap_create(d->nslots);
+    d->refs = kmalloc(d->nslots * sizeof(uint16_t));
+    d->io_lock = lock_create(devname);
+    if (d->name == NULL || d->map == NULL || d->refs == NULL || d->io_lock == NULL ||
+        PAGE_SIZE % d->dev->d_blocksize != 0)
+        panic("Swap device %s could not be set up\n", devname);
+    d->used = 0;
+    d->prio = prio;
+    d->reads = d->writes = 0;
+    nswapdevs++;
+    lock_release(swap_lock);
+    kprintf("Swap device %s size : %d, priority %d\n", devname, (int)stats.st_size, prio);
+    return 0;
+}
 
 void swapmap_init()
 {   
-    open_swapfile();
-    swapMap = bitmap_create(swapFileSize / PAGE_SIZE);
-    KASSERT(swapMap!=NULL);
     swap_lock = lock_create("SWAP_lock");
     if(swap_lock == NULL)
         panic("Swap lock was not created succesfully\n");
+    for (unsigned k = 0; k < sizeof(swapconf) / sizeof(swapconf[0]); k++) {
+        if (swapon(swapconf[k].name, swapconf[k].prio))
+            kprintf("Swap device %s not available\n", swapconf[k].name);
+    }
+    KASSERT(nswapdevs > 0);
 }
 
+void swap_print_devs()
+{
+    lock_acquire(swap_lock);
+    kprintf("overcommit policy %d, %u pages reserved\n", vm_overcommit, swap_reserved);
+    for (unsigned k = 0; k < nswapdevs; k++) {
+        kprintf("%s: prio %d, %u/%u slots used, %u reads, %u writes\n", swapdevs[k].name,
+                swapdevs[k].prio, swapdevs[k].used, swapdevs[k].nslots, swapdevs[k].reads, swapdevs[k].writes);
+    }
+    lock_release(swap_lock);
+}
 
 void close_swapfile()
 {
+    swap_print_devs();
     lock_acquire(swap_lock);
-    int result = vfs_swapoff(swapname);
-    KASSERT(result == 0);
-    bitmap_destroy(swapMap);
+    for (unsigned k = 0; k < nswapdevs; k++) {
+        int result = vfs_swapoff(swapdevs[k].name);
+        KASSERT(result == 0);
+        bitmap_destroy(swapdevs[k].map);
+        kfree(swapdevs[k].refs);
+    }
+    lock_release(swap_lock);
+}
+
+/*
+ * Picks a free slot on the highest priority device that still has room,
+ * rotating among the devices of that priority. swap_lock must be held.
+ */
+static int swap_alloc(unsigned *slot)
+{
+    int best = -1;
+    for (unsigned n = 0; n < nswapdevs; n++) {
+        unsigned k = (swap_rr + n) % nswapdevs;
+        if (swapdevs[k].used < swapdevs[k].nslots && (best < 0 || swapdevs[k].prio > swapdevs[best].prio))
+            best = k;
+    }
+    if (best < 0)
+        return ENOMEM;
+
+    unsigned i;
+    int err = bitmap_alloc(swapdevs[best].map, &i);
+    KASSERT(err == 0);
+    swapdevs[best].refs[i] = 1;
+    swapdevs[best].used++;
+    swap_rr = best + 1;
+    *slot = (unsigned)best << SWAP_DEVSHIFT | i;
+    return 0;
+}
+
+//drops a reference to slot, the last one frees it. swap_lock must be held.
+static void swap_free(unsigned slot)
+{
+    swap_dev *d = &swapdevs[SWAP_DEV(slot)];
+    KASSERT(bitmap_isset(d->map, SWAP_OFF(slot)) != 0);
+    KASSERT(d->refs[SWAP_OFF(slot)] > 0);
+    if (--d->refs[SWAP_OFF(slot)] > 0)
+        return;
+#if OPT_ZSWAP
+    zswap_invalidate(slot);
+#endif
+    bitmap_unmark(d->map, SWAP_OFF(slot)); //sets the swapmap entry as free
+    d->used--;
+}
+
+//one more page table entry (a forked child) refers to slot
+void swap_dup(unsigned slot)
+{
+    lock_acquire(swap_lock);
+    swap_dev *d = &swapdevs[SWAP_DEV(slot)];
+    KASSERT(bitmap_isset(d->map, SWAP_OFF(slot)) != 0);
+    KASSERT(d->refs[SWAP_OFF(slot)] < 0xffff);
+    d->refs[SWAP_OFF(slot)]++;
     lock_release(swap_lock);
+}
+
+/*
+ * Transfers npages pages between the kernel buffers in kvaddrs and consecutive
+ * slots of one swap device, starting at slot, as a single request to the
+ * disk driver. Slots are page-sized and so always sector-aligned.
+ * Only the device holding the slots is locked. Pages are coalesced only by
+ * the compressed pool writeback: eviction picks one frame at a time, so
+ * swap_out and swap_in issue one-page requests.
+ */
+int swap_io_cluster(unsigned slot, vaddr_t *kvaddrs, unsigned npages, enum uio_rw rw)
+{
+    struct iovec iov[SWAP_MAXCLUSTER];
+    struct uio u;
+    swap_dev *d = &swapdevs[SWAP_DEV(slot)];
+    int result;
+
+    KASSERT(SWAP_DEV(slot) < nswapdevs);
+    KASSERT(npages > 0 && npages <= SWAP_MAXCLUSTER);
+    KASSERT(SWAP_OFF(slot) + npages <= d->nslots);
+    for (unsigned k = 0; k < npages; k++) {
+        iov[k].iov_kbase = (void *)kvaddrs[k];
+        iov[k].iov_len = PAGE_SIZE;
+    }
+
+    u.uio_iov = iov;
+    u.uio_iovcnt = npages;
+    u.uio_resid = npages * PAGE_SIZE; // amount to transfer
+    u.uio_offset = (off_t)SWAP_OFF(slot) * PAGE_SIZE;
+    u.uio_segflg = UIO_SYSSPACE;
+    u.uio_rw = rw;
+    u.uio_space = NULL;
 
+    lock_acquire(d->io_lock);
+    result = DEVOP_IO(d->dev, &u);
+    if (rw == UIO_WRITE)
+        d->writes += npages;
+    else
+        d->reads += npages;
+    lock_release(d->io_lock);
+    KASSERT(result != 0 || u.uio_resid == 0);
+    return result;
+}
+
+int swap_io(unsigned slot, vaddr_t kvaddr, enum uio_rw rw)
+{
+    return swap_io_cluster(slot, &kvaddr, 1, rw);
+}
+
+//true if the two slots are next to each other on the same device
+bool swap_adjacent(unsigned slot, unsigned next)
+{
+    return SWAP_DEV(slot) == SWAP_DEV(next) && SWAP_OFF(slot) + 1 == SWAP_OFF(next);
 }
 
 int swap_in(paddr_t *swap_paddr, paddr_t ram_paddr, bool toRemove)
 { //ram_paddr settato precedentemente con swap_out
+    int result = ENOENT;
+    unsigned slot = *swap_paddr;
+    uint64_t start = vm_lat_now();
+
+#if OPT_ZSWAP
     lock_acquire(swap_lock);
-    int result = load_segment(NULL, swapFile, (off_t)(*swap_paddr * PAGE_SIZE), ram_paddr, PAGE_SIZE, PAGE_SIZE, 0); //read the page from the swapfile
+    bool last = swapdevs[SWAP_DEV(slot)].refs[SWAP_OFF(slot)] == 1; //others may still need the pool entry
+    result = zswap_load(slot, ram_paddr, toRemove && last); //check the compressed pool first
+    lock_release(swap_lock);
+#endif
+    if(result)
+        result = swap_io(slot, PADDR_TO_KVADDR(ram_paddr), UIO_READ); //read the page from its device
     if(result)
         return result;
-    
-    KASSERT(bitmap_isset(swapMap, *swap_paddr) != 0);
+
     if(toRemove) {
-        bitmap_unmark(swapMap, *swap_paddr); //sets the swapmap entry which has the same index as the one stored in *swap_paddr as free
-        used -= 1;
+        lock_acquire(swap_lock);
+        swap_free(slot);
+        lock_release(swap_lock);
     }
     *swap_paddr = ram_paddr; //update the paddr with the new one
-    lock_release(swap_lock);
-    return result;
+    uint64_t ns = vm_lat_record(LAT_SWAP_IN, start);
+    VMTRACE(VMTR_SWAPIN, slot, ns);
+    return 0;
 }
 
 int swap_out(paddr_t *paddr)
 {
+    unsigned i;
+    uint64_t start = vm_lat_now();
 
-    struct iovec iov;
-    struct uio u;
     lock_acquire(swap_lock);
-    if (used == swapFileSize) //if so, there is no free space in the swap file
-        return ENOMEM;
-    unsigned i;
+    int err = swap_alloc(&i);
+    if(err) { //no free space left on any swap device
+        lock_release(swap_lock);
+        return err;
+    }
 
-     int err = bitmap_alloc(swapMap, &i); /*searches for a free slot in the bitmap, if there is 
-                                           *one the index of it is put in i, the relative entry 
-                                           is set as filled and the return value is 0, otherwise an error is returned.*/
-     if(err) {
-         lock_release(swap_lock);
-         return err;
-     }
-     
-    iov.iov_ubase = (void *)PADDR_TO_KVADDR(*paddr);
-    iov.iov_len = PAGE_SIZE; // length of the memory space
-
-    u.uio_iov = &iov;
-    u.uio_iovcnt = 1;
-    u.uio_resid = PAGE_SIZE; // amount to read from the file
-    u.uio_offset = i * PAGE_SIZE;
-    u.uio_segflg = UIO_SYSSPACE;
-    u.uio_rw = UIO_WRITE;
-    u.uio_space = NULL;
+#if OPT_ZSWAP
+    if (zswap_store(i, *paddr) == 0) { //the slot stays reserved, the page goes to disk only if the pool refuses it
+        lock_release(swap_lock);
+        *paddr = i;
+        uint64_t ns = vm_lat_record(LAT_SWAP_OUT, start);
+        VMTRACE(VMTR_SWAPOUT, i, ns);
+        return 0;
+    }
+#endif
+    lock_release(swap_lock);
 
-    int result = VOP_WRITE(swapFile, &u); //write to swapfile
+    int result = swap_io(i, PADDR_TO_KVADDR(*paddr), UIO_WRITE); //devices are written in parallel
     KASSERT(result == 0);
 
     *paddr = i;
-    used += 1;
-    lock_release(swap_lock);
+    uint64_t ns = vm_lat_record(LAT_SWAP_OUT, start);
+    VMTRACE(VMTR_SWAPOUT, i, ns);
     return 0;
 }
 
 void clear_swap(paddr_t paddr)
 {
     lock_acquire(swap_lock);
-    bitmap_unmark(swapMap, paddr);
-    used -= 1;
+    swap_free(paddr);
+    lock_release(swap_lock);
+}
+
+/*
+ * Accounts npages of writable memory that may have to be backed by swap:
+ *   VM_OVERCOMMIT_NEVER  - the total promised can not exceed RAM plus swap
+ *   VM_OVERCOMMIT_GUESS  - refuses only a single request that could never fit
+ *   VM_OVERCOMMIT_ALWAYS - never refuses, running out is left to the OOM killer
+ */
+int swap_reserve(unsigned npages)
+{
+    unsigned limit = getRamPages();
+    int result = 0;
+
+    lock_acquire(swap_lock);
+    for (unsigned k = 0; k < nswapdevs; k++)
+        limit += swapdevs[k].nslots;
+    switch (vm_overcommit) {
+    case VM_OVERCOMMIT_NEVER:
+        if (swap_reserved + npages > limit)
+            result = ENOMEM;
+        break;
+    case VM_OVERCOMMIT_GUESS:
+        if (npages > limit)
+            result = ENOMEM;
+        break;
+    default:
+        break;
+    }
+    if (result == 0)
+        swap_reserved += npages;
+    lock_release(swap_lock);
+    return result;
+}
+
+void swap_unreserve(unsigned npages)
+{
+    lock_acquire(swap_lock);
+    KASSERT(swap_reserved >= npages);
+    swap_reserved -= npages;
     lock_release(swap_lock);
 }
 
+int swap_set_overcommit(int policy)
+{
+    if (policy < VM_OVERCOMMIT_GUESS || policy > VM_OVERCOMMIT_NEVER)
+        return EINVAL;
+    lock_acquire(swap_lock);
+    vm_overcommit = policy;
+    lock_release(swap_lock);
+    return 0;
+}
+
 unsigned getAvailableSwap()
 {
+    unsigned sz = 0;
     lock_acquire(swap_lock);
-    unsigned sz = swapFileSize - used;
+    for (unsigned k = 0; k < nswapdevs; k++)
+        sz += swapdevs[k].nslots - swapdevs[k].used;
     lock_release(swap_lock);
     return sz;
-}
\ No newline at end of file
+}
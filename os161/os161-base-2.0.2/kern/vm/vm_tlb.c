@@ -7,7 +7,14 @@
 #include <kern/errno.h>
 #include <vm_tlb.h>
 #include <spl.h>
+#include <vmtrace.h>
+#include <cpu.h>
+#include <current.h>
+#include <synch.h>
+#include <proc.h>
 static int tlb_full = 0;
+static struct lock *shootdown_lock; //one shootdown at a time, its acknowledgements are counted on tlb_acks
+static struct semaphore *tlb_acks;
 
 int tlb_loadentry(vaddr_t faultaddress, paddr_t paddr, bool readOnly)
 {
@@ -61,10 +68,56 @@ int tlb_get_rr_victim(void)
 	return victim;
 }
 
+void tlb_shootdown_init(void)
+{
+	shootdown_lock = lock_create("SHOOTDOWN_lock");
+	tlb_acks = sem_create("TLB_acks", 0);
+	if (shootdown_lock == NULL || tlb_acks == NULL)
+		panic("TLB shootdown lock was not created succesfully\n");
+}
+
+//another CPU changed a page table entry of the address space this one may be running
 void vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	(void)ts; //the TLB does not tell which address space its entries belong to
+	tlb_invalidate();
+	V(tlb_acks);
+}
+
+/*
+ * Drops the entry for vaddr of as from every TLB that may hold it, before
+ * its frame is reused or made read-only. as may be running on any other
+ * CPU, whose whole TLB is flushed: the call returns once they all did.
+ * Only sleep locks may be held.
+ */
+void tlb_shootdown(struct addrspace *as, vaddr_t vaddr)
+{
+	static const struct tlbshootdown flushall;
+	unsigned ncpus = cpuarray_num(&allcpus), sent = 0;
+
+	if (ncpus == 1)
+	{ //an address space not running here has nothing in the TLB, as_activate flushed it
+		if (as == proc_getas())
+			tlb_invalidate_vaddr(vaddr);
+		return;
+	}
+	lock_acquire(shootdown_lock);
+	int spl = splhigh(); //no migration while choosing the other CPUs
+	if (as == proc_getas())
+		tlb_invalidate_vaddr(vaddr);
+	for (unsigned k = 0; k < ncpus; k++)
+	{
+		struct cpu *c = cpuarray_get(&allcpus, k);
+		if (c != curcpu)
+		{
+			ipi_tlbshootdown(c, &flushall);
+			sent++;
+		}
+	}
+	splx(spl);
+	while (sent-- > 0)
+		P(tlb_acks);
+	lock_release(shootdown_lock);
 }
 
 void tlb_invalidate() {
@@ -79,14 +132,17 @@ void tlb_invalidate() {
 	}
 	splx(spl);
 	vm_stats_inc(TLB_INVALIDATION);
+	VMTRACE(VMTR_TLBINV, 0, 1);
 }
 
 void tlb_invalidate_vaddr(vaddr_t vaddr) {
 	int spl = splhigh();
 	vaddr &= PAGE_FRAME;
 	int i;
-	if((i = tlb_probe(vaddr,0)) >= 0)
+	if((i = tlb_probe(vaddr,0)) >= 0) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		VMTRACE(VMTR_TLBINV, vaddr, 0); //only the entries actually dropped
+	}
 
 	splx(spl);
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <limits.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <vmprofile.h>
+
+#define VMPROFILE_HDRSIZE (3 * sizeof(uint32_t)) //magic, binsize and npages
+#define VMPROFILE_FILESIZE (VMPROFILE_HDRSIZE + VMPROFILE_PAGES * sizeof(vaddr_t)) //path excluded
+
+static int binary_size(struct addrspace *as, uint32_t *size)
+{
+    struct stat st;
+    int result = VOP_STAT(as->v, &st);
+    if (result)
+        return result;
+    *size = st.st_size;
+    return 0;
+}
+
+/*
+ * Absolute path of the profile of as, "<progname>.pf" resolved against the
+ * current directory: as_destroy, which saves it, may run in another process
+ * with another current directory. NULL if the directory can not be named.
+ */
+static char *profile_path(struct addrspace *as)
+{
+    struct iovec iov;
+    struct uio ku;
+    size_t len;
+    char *path = kmalloc(PATH_MAX);
+
+    if (path == NULL)
+        return NULL;
+    if (strchr(as->progname, ':') != NULL) { //device:path, absolute already
+        snprintf(path, PATH_MAX, "%s.pf", as->progname);
+        return path;
+    }
+    uio_kinit(&iov, &ku, path, PATH_MAX - 1, 0, UIO_READ);
+    if (vfs_getcwd(&ku) || strchr(path, ':') == NULL) {
+        kfree(path);
+        return NULL;
+    }
+    path[PATH_MAX - 1 - ku.uio_resid] = 0;
+    if (as->progname[0] == '/') //from the root of the device of the current directory
+        strchr(path, ':')[1] = 0;
+    len = strlen(path);
+    snprintf(path + len, PATH_MAX - len, "%s%s.pf", path[len - 1] == ':' ? "" : "/", as->progname);
+    return path;
+}
+
+//vfs_open consumes the path, a new copy is made for each use
+static int profile_open(struct vmprofile *prof, int flags, struct vnode **v)
+{
+    char *path = kstrdup(prof->path);
+    if (path == NULL)
+        return ENOMEM;
+    int result = vfs_open(path, flags, 0664, v);
+    kfree(path);
+    return result;
+}
+
+static bool in_segment(struct addrspace *as, vaddr_t vaddr)
+{
+    for (segment_t *seg = as->as_segment; seg != NULL; seg = seg->next) {
+        if (vaddr >= seg->start && vaddr < seg->start + seg->size)
+            return true;
+    }
+    return false;
+}
+
+static int profile_read(struct addrspace *as, struct vmprofile *prof)
+{
+    struct vnode *v;
+    struct iovec iov;
+    struct uio ku;
+    uint32_t binsize;
+    int result;
+
+    result = binary_size(as, &binsize);
+    if (result)
+        return result;
+    result = profile_open(prof, O_RDONLY, &v);
+    if (result)
+        return result;
+    uio_kinit(&iov, &ku, prof, VMPROFILE_FILESIZE, 0, UIO_READ);
+    result = VOP_READ(v, &ku);
+    vfs_close(v);
+    if (result)
+        return result;
+    if (VMPROFILE_FILESIZE - ku.uio_resid < VMPROFILE_HDRSIZE || prof->magic != VMPROFILE_MAGIC ||
+        prof->binsize != binsize || prof->npages > VMPROFILE_PAGES ||
+        VMPROFILE_FILESIZE - ku.uio_resid < VMPROFILE_HDRSIZE + prof->npages * sizeof(vaddr_t))
+        return EINVAL; //stale or damaged, recorded again
+    return 0;
+}
+
+/*
+ * Called once the program is loaded, before entering user mode: faults in
+ * the pages of the profile if there is one, otherwise starts recording.
+ */
+void vmprofile_start(struct addrspace *as)
+{
+    struct vmprofile *prof = kmalloc(sizeof(*prof));
+    unsigned k, j;
+
+    if (prof == NULL)
+        return;
+    prof->path = profile_path(as);
+    if (prof->path == NULL) {
+        kfree(prof);
+        return;
+    }
+    if (profile_read(as, prof)) {
+        prof->magic = VMPROFILE_MAGIC;
+        prof->npages = 0;
+        if (binary_size(as, &prof->binsize)) {
+            kfree(prof->path);
+            kfree(prof);
+            return;
+        }
+        as->profile = prof;
+        return;
+    }
+
+    //ascending order: consecutive ELF pages end up in the same read-ahead cluster
+    for (k = 1; k < prof->npages; k++) {
+        vaddr_t v = prof->pages[k];
+        for (j = k; j > 0 && prof->pages[j - 1] > v; j--)
+            prof->pages[j] = prof->pages[j - 1];
+        prof->pages[j] = v;
+    }
+    for (k = 0; k < prof->npages; k++) {
+        if (in_segment(as, prof->pages[k]))
+            vm_fault(VM_FAULT_READ, prof->pages[k]);
+    }
+    kfree(prof->path);
+    kfree(prof);
+}
+
+//called by vm_fault for a page brought in from the ELF or zero-filled, with pt_lock held
+void vmprofile_record(struct addrspace *as, vaddr_t vaddr)
+{
+    struct vmprofile *prof = as->profile;
+    if (prof != NULL && prof->npages < VMPROFILE_PAGES)
+        prof->pages[prof->npages++] = vaddr;
+}
+
+//writes the recorded profile, from as_destroy
+void vmprofile_save(struct addrspace *as)
+{
+    struct vmprofile *prof = as->profile;
+    struct vnode *v;
+    struct iovec iov;
+    struct uio ku;
+
+    if (prof == NULL)
+        return;
+    as->profile = NULL;
+    if (prof->npages > 0) {
+        if (profile_open(prof, O_WRONLY | O_CREAT | O_TRUNC, &v) == 0) {
+            uio_kinit(&iov, &ku, prof, VMPROFILE_HDRSIZE + prof->npages * sizeof(vaddr_t), 0, UIO_WRITE);
+            if (VOP_WRITE(v, &ku))
+                kprintf("vm: could not write the profile of %s\n", as->progname);
+            vfs_close(v);
+        }
+    }
+    kfree(prof->path);
+    kfree(prof);
+}
@@ -4,11 +4,44 @@
 #include <spl.h>
 #include "vmstats.h"
 #include <spinlock.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
 #include <addrspace.h>
-/* Counters for tracking statistics */
-static unsigned int counters[STATS_TOT]; //STATS_TOT is defined equalto 10 in the header file
+#include "opt-zswap.h"
+#include "opt-ksm.h"
+#if OPT_KSM
+#include <ksm.h>
+#endif
+#define STATS_CACHELINE 64
 
-struct lock *stats_lock;
+/*
+ * Counters for tracking statistics, one row per CPU: each CPU only writes
+ * its own row, with interrupts off, and the rows are summed up when the
+ * statistics are printed. Rows are cache line aligned so that CPUs
+ * counting at the same time do not write to the same line. The rows are
+ * allocated by vm_bootstrap, once the CPUs are attached.
+ */
+static struct stats_row {
+  unsigned int c[STATS_TOT]; //STATS_TOT is defined equalto 29 in the header file
+} __attribute__((aligned(STATS_CACHELINE))) *percpu;
+
+static unsigned int counters[STATS_TOT]; //totals, filled by vm_stats_print
+
+static struct lat_row {
+  uint32_t hist[LAT_TOT][LAT_BUCKETS];
+  uint64_t total[LAT_TOT]; //for the mean
+} __attribute__((aligned(STATS_CACHELINE))) *percpu_lat;
+
+static unsigned stats_ncpus = 0; //rows of percpu and percpu_lat
+
+static const char *lat_names[] = {
+  "Page Faults",
+  "TLB Reloads",
+  "Swap-ins",
+  "Swap-outs",
+  "ELF Loads",
+};
 
 /* Strings used in printing out the statistics */
 static const char *names[] = {
@@ -22,25 +55,50 @@ static const char *names[] = {
   "Page Faults from ELF",
   "Page Faults from Swapfile",
   "Swapfile Writes",
+  "Swap Pool Stores",
+  "Swap Pool Same-filled",
+  "Swap Pool Bytes",
+  "Swap Pool Hits",
+  "Swap Pool Write-backs",
+  "Swap Pool Rejects",
+  "Zero Pages not Swapped",
+  "Frames taken by OOM killer",
+  "Page Cache Hits",
+  "Copy-on-write Faults",
+  "ELF Read-ahead Pages",
+  "ELF Read-ahead Hits",
+  "Stack Growths",
+  "Mapped Page Write-backs",
+  "Drop-behind Evictions",
+  "Pages Locked",
+  "Pages Unlocked",
+  "Same-page Merges",
+  "Zero Page Mappings",
+  "Shared Frames Evicted",
 };
 
 void
 vm_stats_init()
 {
+  unsigned n = cpuarray_num(&allcpus);
 
-  for (unsigned i=0; i<STATS_TOT; i++) {
-    counters[i] = 0;
-  }
-
-  stats_lock = lock_create("STATS_lock");
-  if(stats_lock == NULL)
-    panic("Stats lock was not created succesfully\n");
+  percpu = kmalloc(n * sizeof(*percpu));
+  percpu_lat = kmalloc(n * sizeof(*percpu_lat));
+  if (percpu == NULL || percpu_lat == NULL)
+    panic("VM statistics were not allocated succesfully\n");
+  bzero(percpu, n * sizeof(*percpu));
+  bzero(percpu_lat, n * sizeof(*percpu_lat));
+  stats_ncpus = n;
 }
 
 void
 vm_stats_print()
 {
-  lock_acquire(stats_lock);
+  for (unsigned i=0; i<STATS_TOT; i++) {
+    counters[i] = 0;
+    for (unsigned k=0; k<stats_ncpus; k++)
+      counters[i] += percpu[k].c[i];
+  }
 
   kprintf("Statistics:\n");
   for (unsigned i=0; i<STATS_TOT; i++) {
@@ -49,7 +107,7 @@ vm_stats_print()
 
   unsigned faults = counters[TLB_FAULT];
   unsigned tot_tlb = counters[TLB_FAULT_WITH_FREE] + counters[TLB_FAULT_WITH_REPLACE];
-  unsigned dzr_sum = counters[PAGE_FAULT_DISK] + counters[PAGE_FAULT_ZEROED] + counters[TLB_RELOAD];
+  unsigned dzr_sum = counters[PAGE_FAULT_DISK] + counters[PAGE_FAULT_ZEROED] + counters[TLB_RELOAD] + counters[PAGE_CACHE_HIT] + counters[COW_FAULT] + counters[ZERO_PAGE_MAP];
   unsigned disk_sum = counters[ELF_READ] + counters[SWAP_READ];
   unsigned disk = counters[PAGE_FAULT_DISK];
 
@@ -59,9 +117,9 @@ vm_stats_print()
       names[TLB_FAULT], faults, names[TLB_FAULT_WITH_FREE], names[TLB_FAULT_WITH_REPLACE], tot_tlb); 
   }
 
-  kprintf("%s + %s + %s = %d\n", names[PAGE_FAULT_DISK],names[PAGE_FAULT_ZEROED], names[TLB_RELOAD], dzr_sum);
+  kprintf("%s + %s + %s + %s + %s + %s = %d\n", names[PAGE_FAULT_DISK],names[PAGE_FAULT_ZEROED], names[TLB_RELOAD], names[PAGE_CACHE_HIT], names[COW_FAULT], names[ZERO_PAGE_MAP], dzr_sum);
   if (faults != dzr_sum) {
-    kprintf("INCONSISTENCY: %s (%d) != %s + %s + %s (%d)\n",  names[TLB_FAULT], faults, names[PAGE_FAULT_DISK],names[PAGE_FAULT_ZEROED], names[TLB_RELOAD], dzr_sum); 
+    kprintf("INCONSISTENCY: %s (%d) != %s + %s + %s + %s + %s + %s (%d)\n",  names[TLB_FAULT], faults, names[PAGE_FAULT_DISK],names[PAGE_FAULT_ZEROED], names[TLB_RELOAD], names[PAGE_CACHE_HIT], names[COW_FAULT], names[ZERO_PAGE_MAP], dzr_sum); 
   }
 
   kprintf("%s + %s = %d\n", names[ELF_READ] , names[SWAP_READ], disk_sum);
@@ -69,22 +127,136 @@ vm_stats_print()
     kprintf("INCONSISTENCY: %s (%d) != %s + %s (%d)\n", names[PAGE_FAULT_DISK], disk, names[ELF_READ], names[SWAP_READ], disk_sum);
   }
 
-  lock_release(stats_lock);
-  lock_destroy(stats_lock);
+  if (counters[ELF_READAHEAD] > 0) {
+    unsigned ratio = (unsigned)((unsigned long long)counters[ELF_READAHEAD_HIT] * 10000 / counters[ELF_READAHEAD]);
+    kprintf("ELF Read-ahead hit ratio = %u.%02u%%\n", ratio / 100, ratio % 100);
+  }
+
+  if (counters[PAGES_LOCKED] != counters[PAGES_UNLOCKED]) {
+    kprintf("Pages Still Locked = %d\n", counters[PAGES_LOCKED] - counters[PAGES_UNLOCKED]);
+  }
+
+#if OPT_ZSWAP
+  //pages kept in the pool never reached the disk, the written back ones did it later
+  unsigned disk_writes = counters[SWAP_WRITE] - counters[SWAP_POOL_STORE] + counters[SWAP_POOL_WRITEBACK];
+  unsigned compressed = counters[SWAP_POOL_STORE] - counters[SWAP_POOL_SAMEFILL];
+  kprintf("Swapfile Disk Writes = %d\n", disk_writes);
+  if (counters[SWAP_POOL_BYTES] > 0) {
+    unsigned ratio = (unsigned)((unsigned long long)compressed * PAGE_SIZE * 100 / counters[SWAP_POOL_BYTES]);
+    kprintf("Swap Pool compression ratio = %u.%02u\n", ratio / 100, ratio % 100);
+  }
+#endif
+
+#if OPT_KSM
+  ksm_print(); //frames merged right now, the counter above only grows
+#endif
+
+  vm_lat_print();
 }
 
-static void
-_vm_stats_inc(unsigned int index)
+//row of the running CPU, interrupts must be off
+static unsigned
+stats_cpu(void)
 {
-  KASSERT(index < STATS_TOT);
-  counters[index]++;
+  unsigned k = CURCPU_EXISTS() ? curcpu->c_number : 0;
+  KASSERT(k < stats_ncpus);
+  return k;
 }
+
 void
 vm_stats_inc(unsigned int index)
 {
-  if(!checkcanLock()) {
-  lock_acquire(stats_lock);
-  _vm_stats_inc(index);
-  lock_release(stats_lock);
-  } else _vm_stats_inc(index);
-}
\ No newline at end of file
+  vm_stats_add(index, 1);
+}
+
+void
+vm_stats_add(unsigned int index, unsigned int amount)
+{
+  KASSERT(index < STATS_TOT);
+  if (stats_ncpus == 0) //before vm_bootstrap
+    return;
+  //no interrupt handler nor migration can get between the load and the store
+  int spl = splhigh();
+  percpu[stats_cpu()].c[index] += amount;
+  splx(spl);
+}
+
+//timestamp for vm_lat_record, from the real-time clock
+uint64_t
+vm_lat_now(void)
+{
+  struct timespec ts;
+
+  gettime(&ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//returns the latency recorded, in ns
+uint64_t
+vm_lat_record(unsigned int type, uint64_t start)
+{
+  uint64_t ns = vm_lat_now() - start;
+  unsigned b = 0;
+
+  KASSERT(type < LAT_TOT);
+  for (uint64_t v = ns >> 1; v != 0 && b < LAT_BUCKETS - 1; v >>= 1)
+    b++;
+  if (stats_ncpus == 0)
+    return ns;
+  int spl = splhigh();
+  struct lat_row *row = &percpu_lat[stats_cpu()];
+  row->hist[type][b]++;
+  row->total[type] += ns;
+  splx(spl);
+  return ns;
+}
+
+//upper bound of the bucket holding the given fraction (in percent) of the samples
+static uint64_t
+lat_percentile(const uint32_t *hist, uint32_t n, unsigned pct)
+{
+  uint64_t want = ((uint64_t)n * pct + 99) / 100, seen = 0;
+  unsigned b;
+
+  for (b = 0; b < LAT_BUCKETS - 1; b++) {
+    seen += hist[b];
+    if (seen >= want)
+      break;
+  }
+  return (uint64_t)2 << b;
+}
+
+/*
+ * Prints the histograms summed over the CPUs. Rows of running CPUs are
+ * read without stopping them, a sample may be missing from the totals.
+ */
+void
+vm_lat_print(void)
+{
+  uint32_t hist[LAT_BUCKETS];
+
+  kprintf("Latencies (ns):\n");
+  for (unsigned t=0; t<LAT_TOT; t++) {
+    uint64_t total = 0;
+    uint32_t n = 0;
+
+    for (unsigned b=0; b<LAT_BUCKETS; b++) {
+      hist[b] = 0;
+      for (unsigned k=0; k<stats_ncpus; k++)
+        hist[b] += percpu_lat[k].hist[t][b];
+      n += hist[b];
+    }
+    if (n == 0)
+      continue;
+    for (unsigned k=0; k<stats_ncpus; k++)
+      total += percpu_lat[k].total[t];
+
+    kprintf("%30s = %10u, mean %llu, p50 < %llu, p99 < %llu\n", lat_names[t], n,
+      (unsigned long long)(total / n), (unsigned long long)lat_percentile(hist, n, 50),
+      (unsigned long long)lat_percentile(hist, n, 99));
+    for (unsigned b=0; b<LAT_BUCKETS; b++) {
+      if (hist[b] != 0)
+        kprintf("%30llu : %u\n", (unsigned long long)1 << b, hist[b]);
+    }
+  }
+}
@@ -0,0 +1,166 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <proc.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vmstats.h>
+#include <vmtrace.h>
+#include "opt-waitpid.h"
+
+struct vmtrace_ring {
+    uint32_t head;   //events ever recorded, the next one goes to head % VMTRACE_RINGSIZE
+    struct vmtrace_event ev[VMTRACE_RINGSIZE];
+};
+
+volatile bool vmtrace_on = false;
+static struct vmtrace_ring *rings[VMTRACE_MAXCPUS];
+static uint32_t dropped = 0;
+
+static uint32_t ring_count(struct vmtrace_ring *r)
+{
+    return r->head < VMTRACE_RINGSIZE ? r->head : VMTRACE_RINGSIZE;
+}
+
+//k-th oldest event still in the ring
+static struct vmtrace_event *ring_event(struct vmtrace_ring *r, uint32_t k)
+{
+    return &r->ev[(r->head - ring_count(r) + k) % VMTRACE_RINGSIZE];
+}
+
+void vmtrace_record(unsigned type, uint32_t a, uint32_t b)
+{
+    uint64_t now = vm_lat_now();
+    int spl = splhigh();
+    unsigned k = CURCPU_EXISTS() ? curcpu->c_number : 0;
+
+    if (k >= VMTRACE_MAXCPUS || rings[k] == NULL) {
+        dropped++;
+        splx(spl);
+        return;
+    }
+    struct vmtrace_ring *r = rings[k];
+    struct vmtrace_event *e = &r->ev[r->head % VMTRACE_RINGSIZE];
+    e->time = now;
+    e->a = a;
+    e->b = b;
+#if OPT_WAITPID
+    e->pid = CURCPU_EXISTS() && curproc != NULL ? curproc->p_pid : 0;
+#else
+    e->pid = 0;
+#endif
+    e->type = type;
+    e->cpu = k;
+    e->pad = 0;
+    r->head++;
+    splx(spl);
+}
+
+//turns tracing on or off, the first time on allocates a ring per attached CPU
+int vmtrace_enable(bool on)
+{
+    unsigned ncpus = cpuarray_num(&allcpus);
+
+    for (unsigned k = 0; on && k < ncpus && k < VMTRACE_MAXCPUS; k++) {
+        if (rings[k] != NULL)
+            continue;
+        struct vmtrace_ring *r = kmalloc(sizeof(*r));
+        if (r == NULL)
+            return ENOMEM; //the rings allocated so far are kept for the next try
+        bzero(r, sizeof(*r));
+        int spl = splhigh();
+        rings[k] = r;
+        splx(spl);
+    }
+    vmtrace_on = on;
+    return 0;
+}
+
+static const char *type_name(uint8_t type)
+{
+    switch (type) {
+    case VMTR_FAULT: return "fault";
+    case VMTR_EVICT: return "evict";
+    case VMTR_SWAPIN: return "swapin";
+    case VMTR_SWAPOUT: return "swapout";
+    case VMTR_TLBINV: return "tlbinv";
+    default: return "?";
+    }
+}
+
+/*
+ * Events are read from the rings while tracing is paused; an event being
+ * recorded on another CPU at that moment may come out torn.
+ */
+void vmtrace_dump(void)
+{
+    bool was_on = vmtrace_on;
+
+    vmtrace_on = false;
+    for (unsigned k = 0; k < VMTRACE_MAXCPUS; k++) {
+        struct vmtrace_ring *r = rings[k];
+        if (r == NULL || r->head == 0)
+            continue;
+        kprintf("cpu%u: %u events, %u overwritten\n", k, r->head, r->head - ring_count(r));
+        for (uint32_t n = 0; n < ring_count(r); n++) {
+            struct vmtrace_event *e = ring_event(r, n);
+            kprintf("%12llu pid %3d %-8s 0x%08x 0x%x\n", (unsigned long long)e->time, e->pid,
+                type_name(e->type), e->a, e->b);
+        }
+    }
+    if (dropped)
+        kprintf("%u events dropped\n", dropped);
+    vmtrace_on = was_on;
+}
+
+//writes the header and the events of all the rings, oldest first for each CPU
+int vmtrace_save(char *path)
+{
+    struct vmtrace_header hdr;
+    struct vnode *v;
+    struct iovec iov;
+    struct uio ku;
+    off_t pos = 0;
+    bool was_on = vmtrace_on;
+    int result;
+
+    result = vfs_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664, &v);
+    if (result)
+        return result;
+    vmtrace_on = false;
+    hdr.magic = VMTRACE_MAGIC;
+    hdr.evsize = sizeof(struct vmtrace_event);
+    hdr.nevents = 0;
+    hdr.dropped = dropped;
+    for (unsigned k = 0; k < VMTRACE_MAXCPUS; k++) {
+        if (rings[k] != NULL)
+            hdr.nevents += ring_count(rings[k]);
+    }
+    uio_kinit(&iov, &ku, &hdr, sizeof(hdr), pos, UIO_WRITE);
+    result = VOP_WRITE(v, &ku);
+    pos = ku.uio_offset;
+    for (unsigned k = 0; k < VMTRACE_MAXCPUS && result == 0; k++) {
+        struct vmtrace_ring *r = rings[k];
+        if (r == NULL)
+            continue;
+        //at most two runs: from the oldest event to the end of the array, then from its start
+        uint32_t n = ring_count(r), first = (r->head - n) % VMTRACE_RINGSIZE;
+        uint32_t run = n < VMTRACE_RINGSIZE - first ? n : VMTRACE_RINGSIZE - first;
+        uio_kinit(&iov, &ku, &r->ev[first], run * sizeof(struct vmtrace_event), pos, UIO_WRITE);
+        result = VOP_WRITE(v, &ku);
+        pos = ku.uio_offset;
+        if (result == 0 && n > run) {
+            uio_kinit(&iov, &ku, &r->ev[0], (n - run) * sizeof(struct vmtrace_event), pos, UIO_WRITE);
+            result = VOP_WRITE(v, &ku);
+            pos = ku.uio_offset;
+        }
+    }
+    vmtrace_on = was_on;
+    vfs_close(v);
+    return result;
+}
@@ -0,0 +1,332 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <uio.h>
+#include <coremap.h>
+#include <swapfile.h>
+#include <vmstats.h>
+#include <zswap.h>
+
+#define ZSWAP_POOLPAGES 16                                   //frames taken from the coremap for the pool
+#define ZSWAP_CHUNK 64                                       //allocation unit inside the pool, in bytes
+#define ZSWAP_NCHUNKS (ZSWAP_POOLPAGES * PAGE_SIZE / ZSWAP_CHUNK)
+#define ZSWAP_MAXLEN (PAGE_SIZE * 3 / 4)                     //pages compressing worse than this go to disk
+#define ZSWAP_MAXENTRIES 512
+#define ZSWAP_HASHSIZE 64
+#define ZSWAP_WBATCH 4 //entries written back together when the pool is full
+#define ZNONE 0xffff
+
+#define LZ_HASHSIZE 1024
+#define LZ_MINMATCH 3
+#define LZ_MAXMATCH (LZ_MINMATCH + 15)
+#define LZ_MAXOFFSET 4095
+#define LZ_HASH(p) (((p)[0] << 6 ^ (p)[1] << 3 ^ (p)[2]) & (LZ_HASHSIZE - 1))
+
+typedef struct z_entry {
+    unsigned slot;   //swap slot the page belongs to
+    uint32_t fill;   //repeated word, for same-filled pages
+    uint32_t seq;    //store order, the oldest entry is the first to be written back
+    uint16_t chunk;  //first chunk of the compressed data in the pool
+    uint16_t len;    //compressed length in bytes
+    uint16_t next;   //next entry in the same hash bucket
+    bool valid : 1;
+    bool same_filled : 1;
+} z_entry;
+
+static char *pool;
+static uint8_t chunkmap[ZSWAP_NCHUNKS];
+static z_entry zentries[ZSWAP_MAXENTRIES];
+static uint16_t zhash[ZSWAP_HASHSIZE];
+static uint16_t lzdict[LZ_HASHSIZE];
+static uint8_t zbuf[ZSWAP_MAXLEN];  //output of the compressor
+static uint8_t zpages[ZSWAP_WBATCH][PAGE_SIZE]; //decompressed pages during write-back
+static uint32_t zseq = 0;
+
+/*
+ * LZRW1-style compressor: every control byte announces 8 items, each one
+ * either a literal byte or a 2-byte back-reference (12 bit offset, 4 bit length).
+ * Returns the compressed length, 0 if the output would not fit in maxlen.
+ * Stale dictionary entries are harmless, every candidate is checked before use.
+ */
+static size_t lz_compress(const uint8_t *src, size_t srclen, uint8_t *dst, size_t maxlen)
+{
+    size_t pos = 0, op = 0, ctrlpos = 0;
+    unsigned bit = 8;
+
+    while (pos < srclen) {
+        if (bit == 8) {
+            if (op >= maxlen)
+                return 0;
+            ctrlpos = op++;
+            dst[ctrlpos] = 0;
+            bit = 0;
+        }
+        size_t mlen = 0, moff = 0;
+        if (srclen - pos >= LZ_MINMATCH) {
+            unsigned h = LZ_HASH(src + pos);
+            size_t cand = lzdict[h];
+            lzdict[h] = pos;
+            if (cand < pos && pos - cand <= LZ_MAXOFFSET) {
+                size_t lim = srclen - pos < LZ_MAXMATCH ? srclen - pos : LZ_MAXMATCH;
+                while (mlen < lim && src[cand + mlen] == src[pos + mlen])
+                    mlen++;
+                moff = pos - cand;
+            }
+        }
+        if (mlen >= LZ_MINMATCH) {
+            if (op + 2 > maxlen)
+                return 0;
+            dst[ctrlpos] |= 1 << bit;
+            dst[op++] = moff >> 4;
+            dst[op++] = (moff & 0xf) << 4 | (mlen - LZ_MINMATCH);
+            pos += mlen;
+        } else {
+            if (op + 1 > maxlen)
+                return 0;
+            dst[op++] = src[pos++];
+        }
+        bit++;
+    }
+    return op;
+}
+
+static int lz_decompress(const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstlen)
+{
+    size_t ip = 0, op = 0;
+    unsigned ctrl = 0, bit = 8;
+
+    while (op < dstlen) {
+        if (bit == 8) {
+            if (ip >= srclen)
+                return EINVAL;
+            ctrl = src[ip++];
+            bit = 0;
+        }
+        if (ctrl & (1 << bit)) {
+            if (ip + 2 > srclen)
+                return EINVAL;
+            size_t off = src[ip] << 4 | src[ip + 1] >> 4;
+            size_t len = (src[ip + 1] & 0xf) + LZ_MINMATCH;
+            ip += 2;
+            if (off == 0 || off > op || op + len > dstlen)
+                return EINVAL;
+            for (size_t k = 0; k < len; k++, op++)
+                dst[op] = dst[op - off];
+        } else {
+            if (ip >= srclen)
+                return EINVAL;
+            dst[op++] = src[ip++];
+        }
+        bit++;
+    }
+    return 0;
+}
+
+//word-wise scan, true if the whole page repeats the same 32 bit value
+static bool same_filled(const uint32_t *w, uint32_t *fill)
+{
+    for (unsigned k = 1; k < PAGE_SIZE / sizeof(uint32_t); k++) {
+        if (w[k] != w[0])
+            return false;
+    }
+    *fill = w[0];
+    return true;
+}
+
+static void fill_page(uint32_t *w, uint32_t fill)
+{
+    for (unsigned k = 0; k < PAGE_SIZE / sizeof(uint32_t); k++)
+        w[k] = fill;
+}
+
+static int chunk_alloc(unsigned n, uint16_t *first)
+{
+    unsigned run = 0;
+    for (unsigned c = 0; c < ZSWAP_NCHUNKS; c++) {
+        if (chunkmap[c]) {
+            run = 0;
+            continue;
+        }
+        if (++run == n) {
+            *first = c + 1 - n;
+            memset(&chunkmap[*first], 1, n);
+            return 0;
+        }
+    }
+    return ENOSPC;
+}
+
+static int entry_lookup(unsigned slot)
+{
+    uint16_t e;
+    for (e = zhash[slot % ZSWAP_HASHSIZE]; e != ZNONE; e = zentries[e].next) {
+        if (zentries[e].slot == slot)
+            return e;
+    }
+    return -1;
+}
+
+static int entry_free_index(void)
+{
+    for (unsigned e = 0; e < ZSWAP_MAXENTRIES; e++) {
+        if (!zentries[e].valid)
+            return e;
+    }
+    return -1;
+}
+
+static void entry_free(int e)
+{
+    z_entry *z = &zentries[e];
+    uint16_t *link;
+
+    for (link = &zhash[z->slot % ZSWAP_HASHSIZE]; *link != e; link = &zentries[*link].next)
+        KASSERT(*link != ZNONE);
+    *link = z->next;
+    if (!z->same_filled)
+        bzero(&chunkmap[z->chunk], DIVROUNDUP(z->len, ZSWAP_CHUNK));
+    z->valid = 0;
+}
+
+static void entry_unpack(z_entry *z, void *page)
+{
+    if (z->same_filled) {
+        fill_page(page, z->fill);
+    } else {
+        int result = lz_decompress((uint8_t *)pool + z->chunk * ZSWAP_CHUNK, z->len, page, PAGE_SIZE);
+        KASSERT(result == 0);
+    }
+}
+
+static bool in_batch(int e, int *batch, unsigned n)
+{
+    for (unsigned k = 0; k < n; k++) {
+        if (batch[k] == e)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Writes the coldest entries of the pool to their slots on disk, returns ENOSPC
+ * if the pool is empty. The batch is sorted by slot so that entries sitting in
+ * adjacent slots of the same device go out as a single request.
+ */
+static int zswap_writeback(void)
+{
+    int batch[ZSWAP_WBATCH];
+    vaddr_t kvaddrs[ZSWAP_WBATCH];
+    unsigned n, k, run;
+
+    for (n = 0; n < ZSWAP_WBATCH; n++) {
+        int victim = -1;
+        for (unsigned e = 0; e < ZSWAP_MAXENTRIES; e++) {
+            if (zentries[e].valid && !in_batch(e, batch, n) &&
+                (victim < 0 || (int32_t)(zentries[e].seq - zentries[victim].seq) < 0))
+                victim = e;
+        }
+        if (victim < 0)
+            break;
+        for (k = n; k > 0 && zentries[batch[k - 1]].slot > zentries[victim].slot; k--)
+            batch[k] = batch[k - 1];
+        batch[k] = victim;
+    }
+    if (n == 0)
+        return ENOSPC;
+
+    for (k = 0; k < n; k++) {
+        entry_unpack(&zentries[batch[k]], zpages[k]);
+        kvaddrs[k] = (vaddr_t)zpages[k];
+    }
+    for (k = 0; k < n; k += run) {
+        for (run = 1; k + run < n && swap_adjacent(zentries[batch[k + run - 1]].slot, zentries[batch[k + run]].slot); run++);
+        int result = swap_io_cluster(zentries[batch[k]].slot, &kvaddrs[k], run, UIO_WRITE);
+        KASSERT(result == 0);
+    }
+    for (k = 0; k < n; k++)
+        entry_free(batch[k]);
+    vm_stats_add(SWAP_POOL_WRITEBACK, n);
+    return 0;
+}
+
+void zswap_init(void)
+{
+    paddr_t paddr = reservePages(ZSWAP_POOLPAGES);
+    if (paddr == 0)
+        panic("Could not reserve the compressed swap pool\n");
+    pool = (char *)PADDR_TO_KVADDR(paddr);
+    for (unsigned h = 0; h < ZSWAP_HASHSIZE; h++)
+        zhash[h] = ZNONE;
+    for (unsigned h = 0; h < LZ_HASHSIZE; h++)
+        lzdict[h] = ZNONE;
+    kprintf("Swap pool size : %d\n", ZSWAP_POOLPAGES * PAGE_SIZE);
+}
+
+/*
+ * Try to keep the page at paddr in the pool under the given slot.
+ * Returns 0 if it was stored, otherwise the page has to be written to disk.
+ */
+int zswap_store(unsigned slot, paddr_t paddr)
+{
+    const void *page = (const void *)PADDR_TO_KVADDR(paddr);
+    uint32_t fill = 0;
+    size_t len = 0;
+    uint16_t chunk = 0;
+    int e;
+
+    KASSERT(entry_lookup(slot) < 0);
+    bool same = same_filled(page, &fill);
+    if (!same) {
+        len = lz_compress(page, PAGE_SIZE, zbuf, ZSWAP_MAXLEN);
+        if (len == 0) { //incompressible, not worth the pool space
+            vm_stats_inc(SWAP_POOL_REJECT);
+            return EFBIG;
+        }
+    }
+
+    while ((e = entry_free_index()) < 0 || (!same && chunk_alloc(DIVROUNDUP(len, ZSWAP_CHUNK), &chunk))) {
+        if (zswap_writeback()) //make room by pushing the coldest pages to disk
+            return ENOSPC;
+    }
+
+    z_entry *z = &zentries[e];
+    z->slot = slot;
+    z->fill = fill;
+    z->seq = zseq++;
+    z->chunk = chunk;
+    z->len = len;
+    z->same_filled = same;
+    z->valid = 1;
+    z->next = zhash[slot % ZSWAP_HASHSIZE];
+    zhash[slot % ZSWAP_HASHSIZE] = e;
+    if (!same)
+        memcpy(pool + chunk * ZSWAP_CHUNK, zbuf, len);
+
+    vm_stats_inc(SWAP_POOL_STORE);
+    if (same)
+        vm_stats_inc(SWAP_POOL_SAMEFILL);
+    else
+        vm_stats_add(SWAP_POOL_BYTES, len);
+    return 0;
+}
+
+//copy the page kept under slot to paddr, returns ENOENT if it is not in the pool
+int zswap_load(unsigned slot, paddr_t paddr, bool toRemove)
+{
+    int e = entry_lookup(slot);
+    if (e < 0)
+        return ENOENT;
+    entry_unpack(&zentries[e], (void *)PADDR_TO_KVADDR(paddr));
+    if (toRemove)
+        entry_free(e);
+    vm_stats_inc(SWAP_POOL_HIT);
+    return 0;
+}
+
+void zswap_invalidate(unsigned slot)
+{
+    int e = entry_lookup(slot);
+    if (e >= 0)
+        entry_free(e);
+}